@@ -0,0 +1,745 @@
+/** @file
+ *  @brief Streaming benchmark central
+ *
+ *  Connects to the ADC BLE peripheral, subscribes to the sample frames
+ *  (6E400002), or connects its L2CAP sample channel with
+ *  CONFIG_BENCH_COC, and to the control responses, and runs every point
+ *  of a matrix of PHY, connection interval and scan rate on that
+ *  connection. Every point prints one line once it has been measured:
+ *
+ *    BENCH transport=gatt mtu=247 phy=2M interval_us=7500 rate=1000
+ *          samples_s=... bytes_s=... lost=... p50_us=... p99_us=...
+ *          overflows=... dropped=... ctrl_max_us=...
+ *
+ *  Built for nrf52_bsim, where both devices boot at the same simulated
+ *  time, so a sample timestamp (peripheral uptime) compares directly
+ *  with the central's uptime and gives the latency from conversion to
+ *  delivery.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/l2cap.h>
+
+#include "sample_frame.h"
+#include "control.h"
+
+LOG_MODULE_REGISTER(bench, LOG_LEVEL_INF);
+
+static const struct bt_uuid_128 sample_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400002, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static const struct bt_uuid_128 control_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4));
+
+/* Matrix, MTU is set at build time by the configuration overlay */
+static const uint8_t phys[] = { BT_GAP_LE_PHY_1M, BT_GAP_LE_PHY_2M };
+/* Connection intervals in 1.25 ms units */
+static const uint16_t intervals[] = { 6, 12, 40 };
+static const uint16_t rates[] = { 100, 500, 1000, 2000 };
+
+#define CONN_TIMEOUT 400
+#define CONTROL_TIMEOUT K_SECONDS(5)
+
+/* Latency histogram, the last bucket collects everything beyond it */
+#define LAT_BUCKET_US 250U
+#define LAT_BUCKETS 4096U
+
+static struct bt_conn *conn;
+
+static K_SEM_DEFINE(conn_sem, 0, 1);
+static K_SEM_DEFINE(sec_sem, 0, 1);
+static K_SEM_DEFINE(done_sem, 0, 1);
+static K_SEM_DEFINE(update_sem, 0, 1);
+static K_SEM_DEFINE(rsp_sem, 0, 1);
+
+static int proc_err;
+
+static uint16_t sample_handle;
+static uint16_t control_handle;
+
+static struct bt_gatt_discover_params disc_params;
+static struct bt_gatt_discover_params sample_ccc_disc;
+static struct bt_gatt_discover_params control_ccc_disc;
+static struct bt_gatt_subscribe_params sample_sub;
+static struct bt_gatt_subscribe_params control_sub;
+
+static uint8_t rsp[CONTROL_MAX_LEN];
+static uint16_t rsp_len;
+static uint8_t token;
+
+static struct k_spinlock lock;
+static struct {
+	bool measuring;
+	bool seq_valid;
+	uint16_t next_seq;
+	uint32_t samples;
+	uint32_t bytes;
+	uint32_t lost;
+	uint32_t latencies;
+	uint32_t hist[LAT_BUCKETS];
+} rx;
+
+static void record_frame(const uint8_t *data, uint16_t len)
+{
+	int64_t now = k_uptime_ticks();
+	struct sample_frame_hdr hdr;
+	k_spinlock_key_t key;
+	uint16_t gap;
+	int n;
+
+	n = sample_frame_parse(data, len, &hdr);
+	if (n < 0) {
+		LOG_WRN("Malformed frame (err %d)", n);
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+
+	/* A gap of more than half the sequence space is a restart */
+	gap = hdr.seq - rx.next_seq;
+	if (rx.measuring && rx.seq_valid && gap < BIT(15)) {
+		rx.lost += gap;
+	}
+	rx.next_seq = hdr.seq + n;
+	rx.seq_valid = true;
+
+	if (!rx.measuring) {
+		k_spin_unlock(&lock, key);
+		return;
+	}
+
+	rx.samples += n;
+	rx.bytes += len;
+
+	/* Wall clock timestamps cannot be compared with the uptime */
+	for (int i = 0; i < n && !(hdr.flags & SAMPLE_FRAME_FLAG_EPOCH); i++) {
+		int64_t ticks = now - (int64_t)(hdr.ticks + i * hdr.period);
+		uint64_t us = k_ticks_to_us_floor64(MAX(ticks, 0));
+
+		rx.hist[MIN(us / LAT_BUCKET_US, LAT_BUCKETS - 1U)]++;
+		rx.latencies++;
+	}
+
+	k_spin_unlock(&lock, key);
+}
+
+static uint8_t sample_notify(struct bt_conn *conn,
+			     struct bt_gatt_subscribe_params *params,
+			     const void *data, uint16_t length)
+{
+	if (!data) {
+		params->value_handle = 0U;
+		return BT_GATT_ITER_STOP;
+	}
+
+	record_frame(data, length);
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+#if defined(CONFIG_BENCH_COC)
+NET_BUF_POOL_FIXED_DEFINE(sdu_pool, 2,
+			  BT_L2CAP_SDU_BUF_SIZE(CONFIG_BENCH_COC_MTU), 8, NULL);
+
+static struct bt_l2cap_le_chan coc_chan;
+static K_SEM_DEFINE(coc_sem, 0, 1);
+
+static struct net_buf *coc_alloc_buf(struct bt_l2cap_chan *chan)
+{
+	return net_buf_alloc(&sdu_pool, K_FOREVER);
+}
+
+static int coc_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+	record_frame(buf->data, buf->len);
+
+	return 0;
+}
+
+static void coc_connected(struct bt_l2cap_chan *chan)
+{
+	k_sem_give(&coc_sem);
+}
+
+static void coc_disconnected(struct bt_l2cap_chan *chan)
+{
+	LOG_ERR("Sample channel disconnected");
+}
+
+static const struct bt_l2cap_chan_ops coc_ops = {
+	.alloc_buf = coc_alloc_buf,
+	.recv = coc_recv,
+	.connected = coc_connected,
+	.disconnected = coc_disconnected,
+};
+
+static int connect_coc(void)
+{
+	int err;
+
+	coc_chan.chan.ops = &coc_ops;
+	coc_chan.rx.mtu = CONFIG_BENCH_COC_MTU;
+
+	err = bt_l2cap_chan_connect(conn, &coc_chan.chan,
+				    CONFIG_BENCH_COC_PSM);
+	if (err) {
+		return err;
+	}
+
+	return k_sem_take(&coc_sem, K_SECONDS(10));
+}
+#else
+static int connect_coc(void)
+{
+	return -ENOTSUP;
+}
+#endif /* CONFIG_BENCH_COC */
+
+static uint8_t control_notify(struct bt_conn *conn,
+			      struct bt_gatt_subscribe_params *params,
+			      const void *data, uint16_t length)
+{
+	if (!data) {
+		params->value_handle = 0U;
+		return BT_GATT_ITER_STOP;
+	}
+
+	if (length < CONTROL_RSP_HDR_LEN || length > sizeof(rsp)) {
+		LOG_WRN("Malformed control response");
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	memcpy(rsp, data, length);
+	rsp_len = length;
+	k_sem_give(&rsp_sem);
+
+	return BT_GATT_ITER_CONTINUE;
+}
+
+/* Sends a command and waits for its response, results go to out */
+static int control(uint8_t op, const void *param, size_t param_len,
+		   void *out, size_t out_len)
+{
+	uint8_t req[CONTROL_MAX_LEN];
+	int err;
+
+	if (CONTROL_REQ_HDR_LEN + param_len > sizeof(req)) {
+		return -EINVAL;
+	}
+
+	req[0] = op;
+	req[1] = ++token;
+	if (param_len) {
+		memcpy(&req[CONTROL_REQ_HDR_LEN], param, param_len);
+	}
+
+	k_sem_reset(&rsp_sem);
+
+	err = bt_gatt_write_without_response(conn, control_handle, req,
+					     CONTROL_REQ_HDR_LEN + param_len,
+					     false);
+	if (err) {
+		return err;
+	}
+
+	do {
+		if (k_sem_take(&rsp_sem, CONTROL_TIMEOUT)) {
+			return -ETIMEDOUT;
+		}
+	} while (rsp[0] != (op | CONTROL_RESPONSE) || rsp[1] != token);
+
+	if (rsp[2] != CONTROL_STATUS_OK) {
+		LOG_ERR("Command 0x%02x failed (status %u)", op, rsp[2]);
+		return -EIO;
+	}
+
+	if (rsp_len - CONTROL_RSP_HDR_LEN < out_len) {
+		return -EMSGSIZE;
+	}
+
+	if (out_len) {
+		memcpy(out, &rsp[CONTROL_RSP_HDR_LEN], out_len);
+	}
+
+	return 0;
+}
+
+struct peer_stats {
+	uint32_t scans;
+	uint32_t overflows;
+	uint32_t frames;
+	uint32_t dropped;
+};
+
+static int get_stats(struct peer_stats *stats)
+{
+	uint8_t buf[4 * sizeof(uint32_t)];
+	int err;
+
+	err = control(CONTROL_OP_GET_STATS, NULL, 0, buf, sizeof(buf));
+	if (err) {
+		return err;
+	}
+
+	stats->scans = sys_get_le32(&buf[0]);
+	stats->overflows = sys_get_le32(&buf[4]);
+	stats->frames = sys_get_le32(&buf[8]);
+	stats->dropped = sys_get_le32(&buf[12]);
+
+	return 0;
+}
+
+static uint32_t percentile_us(uint32_t pct)
+{
+	uint64_t target = (uint64_t)rx.latencies * pct;
+	uint64_t seen = 0U;
+
+	for (size_t i = 0; i < LAT_BUCKETS; i++) {
+		seen += rx.hist[i];
+		if (seen * 100U >= target) {
+			return (i + 1U) * LAT_BUCKET_US;
+		}
+	}
+
+	return LAT_BUCKETS * LAT_BUCKET_US;
+}
+
+static void subscribed(struct bt_conn *conn, uint8_t err,
+		       struct bt_gatt_subscribe_params *params)
+{
+	proc_err = err;
+	k_sem_give(&done_sem);
+}
+
+static int subscribe(struct bt_gatt_subscribe_params *params,
+		     struct bt_gatt_discover_params *ccc_disc,
+		     uint16_t value_handle, bt_gatt_notify_func_t notify)
+{
+	int err;
+
+	params->notify = notify;
+	params->subscribe = subscribed;
+	params->value = BT_GATT_CCC_NOTIFY;
+	params->value_handle = value_handle;
+	params->ccc_handle = 0U;
+	params->end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	params->disc_params = ccc_disc;
+
+	err = bt_gatt_subscribe(conn, params);
+	if (err) {
+		return err;
+	}
+
+	k_sem_take(&done_sem, K_FOREVER);
+
+	return proc_err;
+}
+
+static uint8_t discovered(struct bt_conn *conn,
+			  const struct bt_gatt_attr *attr,
+			  struct bt_gatt_discover_params *params)
+{
+	uint16_t *handle;
+
+	if (!attr) {
+		k_sem_give(&done_sem);
+		return BT_GATT_ITER_STOP;
+	}
+
+	handle = bt_uuid_cmp(params->uuid, &sample_uuid.uuid) == 0 ?
+		 &sample_handle : &control_handle;
+	*handle = ((struct bt_gatt_chrc *)attr->user_data)->value_handle;
+
+	k_sem_give(&done_sem);
+
+	return BT_GATT_ITER_STOP;
+}
+
+static int discover(const struct bt_uuid *uuid, uint16_t *handle)
+{
+	int err;
+
+	*handle = 0U;
+
+	disc_params.uuid = uuid;
+	disc_params.func = discovered;
+	disc_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	disc_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	disc_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+	err = bt_gatt_discover(conn, &disc_params);
+	if (err) {
+		return err;
+	}
+
+	k_sem_take(&done_sem, K_FOREVER);
+
+	return *handle ? 0 : -ENOENT;
+}
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	proc_err = err;
+	k_sem_give(&done_sem);
+}
+
+static int set_phy(uint8_t phy)
+{
+	struct bt_conn_le_phy_param param = {
+		.options = BT_CONN_LE_PHY_OPT_NONE,
+		.pref_tx_phy = phy,
+		.pref_rx_phy = phy,
+	};
+	struct bt_conn_info info;
+	int err;
+
+	bt_conn_get_info(conn, &info);
+	if (info.le.phy->tx_phy == phy && info.le.phy->rx_phy == phy) {
+		return 0;
+	}
+
+	k_sem_reset(&update_sem);
+
+	err = bt_conn_le_phy_update(conn, &param);
+	if (err) {
+		return err;
+	}
+
+	return k_sem_take(&update_sem, K_SECONDS(10));
+}
+
+static int set_interval(uint16_t interval)
+{
+	struct bt_conn_info info;
+	int err;
+
+	bt_conn_get_info(conn, &info);
+	if (info.le.interval == interval) {
+		return 0;
+	}
+
+	k_sem_reset(&update_sem);
+
+	err = bt_conn_le_param_update(conn, BT_LE_CONN_PARAM(interval,
+							     interval, 0,
+							     CONN_TIMEOUT));
+	if (err) {
+		return err;
+	}
+
+	return k_sem_take(&update_sem, K_SECONDS(10));
+}
+
+static int run_point(uint8_t phy, uint16_t interval, uint16_t rate)
+{
+	struct peer_stats before, after;
+	k_spinlock_key_t key;
+	uint8_t param[sizeof(uint16_t)];
+	uint32_t secs = CONFIG_BENCH_MEASURE_MS / 1000U;
+	int64_t ctrl_max = 0;
+	int err;
+
+	err = set_phy(phy);
+	if (err) {
+		LOG_ERR("PHY update failed (err %d)", err);
+		return err;
+	}
+
+	err = set_interval(interval);
+	if (err) {
+		LOG_ERR("Connection update failed (err %d)", err);
+		return err;
+	}
+
+	sys_put_le16(rate, param);
+	err = control(CONTROL_OP_SET_RATE, param, sizeof(param), NULL, 0);
+	if (err) {
+		return err;
+	}
+
+	/* Lets the ring and the frame batching reach their steady state */
+	k_sleep(K_MSEC(CONFIG_BENCH_SETTLE_MS));
+
+	err = get_stats(&before);
+	if (err) {
+		return err;
+	}
+
+	key = k_spin_lock(&lock);
+	memset(&rx, 0, sizeof(rx));
+	rx.measuring = true;
+	k_spin_unlock(&lock, key);
+
+	/* A command per second under load, its round trip is what a stop
+	 * or amplitude command waits for
+	 */
+	for (uint32_t i = 0U; i < secs; i++) {
+		struct peer_stats probe;
+		int64_t start;
+
+		k_sleep(K_SECONDS(1));
+
+		start = k_uptime_ticks();
+		err = get_stats(&probe);
+		if (err) {
+			return err;
+		}
+
+		ctrl_max = MAX(ctrl_max, k_uptime_ticks() - start);
+	}
+
+	key = k_spin_lock(&lock);
+	rx.measuring = false;
+	k_spin_unlock(&lock, key);
+
+	err = get_stats(&after);
+	if (err) {
+		return err;
+	}
+
+	printk("BENCH transport=%s mtu=%u phy=%s interval_us=%u rate=%u "
+	       "samples_s=%u bytes_s=%u lost=%u p50_us=%u p99_us=%u "
+	       "overflows=%u dropped=%u ctrl_max_us=%u\n",
+	       IS_ENABLED(CONFIG_BENCH_COC) ? "coc" :
+	       IS_ENABLED(CONFIG_BT_EATT) ? "eatt" : "gatt",
+	       bt_gatt_get_mtu(conn), phy == BT_GAP_LE_PHY_2M ? "2M" : "1M",
+	       interval * 1250U, rate, rx.samples / secs, rx.bytes / secs,
+	       rx.lost, percentile_us(50), percentile_us(99),
+	       after.overflows - before.overflows,
+	       after.dropped - before.dropped,
+	       (uint32_t)k_ticks_to_us_ceil64(ctrl_max));
+
+	return 0;
+}
+
+static int setup_link(void)
+{
+	static struct bt_gatt_exchange_params xchg = {
+		.func = mtu_exchanged,
+	};
+	int err;
+
+	err = bt_conn_set_security(conn, BT_SECURITY_L2);
+	if (err) {
+		return err;
+	}
+
+	/* The CCCs of the sample characteristic need an encrypted link */
+	k_sem_take(&sec_sem, K_FOREVER);
+
+	err = bt_gatt_exchange_mtu(conn, &xchg);
+	if (err) {
+		return err;
+	}
+
+	k_sem_take(&done_sem, K_FOREVER);
+
+	err = discover(&sample_uuid.uuid, &sample_handle);
+	if (err) {
+		LOG_ERR("Sample characteristic not found (err %d)", err);
+		return err;
+	}
+
+	err = discover(&control_uuid.uuid, &control_handle);
+	if (err) {
+		LOG_ERR("Control characteristic not found (err %d)", err);
+		return err;
+	}
+
+	err = subscribe(&control_sub, &control_ccc_disc, control_handle,
+			control_notify);
+	if (err) {
+		return err;
+	}
+
+	if (IS_ENABLED(CONFIG_BENCH_COC)) {
+		err = connect_coc();
+		if (err) {
+			LOG_ERR("Sample channel not connected (err %d)", err);
+		}
+
+		return err;
+	}
+
+	return subscribe(&sample_sub, &sample_ccc_disc, sample_handle,
+			 sample_notify);
+}
+
+/* The peripheral advertises its summary (src/summary.h) as manufacturer
+ * data, the service UUID is only in the scan response
+ */
+static bool ad_has_summary(struct bt_data *data, void *user_data)
+{
+	bool *found = user_data;
+
+	if (data->type != BT_DATA_MANUFACTURER_DATA ||
+	    data->data_len < sizeof(uint16_t)) {
+		return true;
+	}
+
+	if (sys_get_le16(data->data) == CONFIG_BENCH_COMPANY_ID) {
+		*found = true;
+		return false;
+	}
+
+	return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi,
+			 uint8_t type, struct net_buf_simple *ad)
+{
+	bool found = false;
+	int err;
+
+	if (conn || type != BT_GAP_ADV_TYPE_ADV_IND) {
+		return;
+	}
+
+	bt_data_parse(ad, ad_has_summary, &found);
+	if (!found) {
+		return;
+	}
+
+	err = bt_le_scan_stop();
+	if (err) {
+		return;
+	}
+
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN,
+				BT_LE_CONN_PARAM(intervals[0], intervals[0],
+						 0, CONN_TIMEOUT),
+				&conn);
+	if (err) {
+		LOG_ERR("Create connection failed (err %d)", err);
+	}
+}
+
+static void connected(struct bt_conn *c, uint8_t err)
+{
+	if (err) {
+		LOG_ERR("Connection failed (err 0x%02x)", err);
+		bt_conn_unref(conn);
+		conn = NULL;
+		bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+		return;
+	}
+
+	k_sem_give(&conn_sem);
+}
+
+static void disconnected(struct bt_conn *c, uint8_t reason)
+{
+	/* The run is invalid past this point, the next command times out */
+	LOG_ERR("Disconnected (reason 0x%02x)", reason);
+}
+
+static void security_changed(struct bt_conn *c, bt_security_t level,
+			     enum bt_security_err err)
+{
+	k_sem_give(&sec_sem);
+}
+
+/* The matrix sets the parameters, requests from the peripheral are refused */
+static bool le_param_req(struct bt_conn *c, struct bt_le_conn_param *param)
+{
+	return false;
+}
+
+static void le_param_updated(struct bt_conn *c, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	k_sem_give(&update_sem);
+}
+
+static void le_phy_updated(struct bt_conn *c,
+			   struct bt_conn_le_phy_info *param)
+{
+	k_sem_give(&update_sem);
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.security_changed = security_changed,
+	.le_param_req = le_param_req,
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+};
+
+int main(void)
+{
+	uint8_t channels[1 + CONFIG_BENCH_CHANNELS];
+	int err;
+
+	err = bt_enable(NULL);
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		return 0;
+	}
+
+	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	if (err) {
+		LOG_ERR("Scanning failed to start (err %d)", err);
+		return 0;
+	}
+
+	k_sem_take(&conn_sem, K_FOREVER);
+
+	err = setup_link();
+	if (err) {
+		LOG_ERR("Link setup failed (err %d)", err);
+		printk("BENCH failed\n");
+		return 0;
+	}
+
+	/* Every channel at the full rate, so all samples share one frame
+	 * sequence
+	 */
+	channels[0] = BIT_MASK(CONFIG_BENCH_CHANNELS);
+	memset(&channels[1], 1, CONFIG_BENCH_CHANNELS);
+
+	err = control(CONTROL_OP_SET_CHANNELS, channels, sizeof(channels),
+		      NULL, 0);
+	if (!err) {
+		err = control(CONTROL_OP_START, NULL, 0, NULL, 0);
+	}
+	if (err) {
+		LOG_ERR("Peripheral setup failed (err %d)", err);
+		printk("BENCH failed\n");
+		return 0;
+	}
+
+	for (size_t p = 0; p < ARRAY_SIZE(phys); p++) {
+		for (size_t i = 0; i < ARRAY_SIZE(intervals); i++) {
+			for (size_t r = 0; r < ARRAY_SIZE(rates); r++) {
+				err = run_point(phys[p], intervals[i],
+						rates[r]);
+				if (err) {
+					printk("BENCH failed\n");
+					return 0;
+				}
+			}
+		}
+	}
+
+	printk("BENCH done\n");
+
+	return 0;
+}
@@ -0,0 +1,130 @@
+#!/usr/bin/env bash
+# SPDX-License-Identifier: Apache-2.0
+#
+# Streaming benchmark in BabbleSim: this application as the peripheral,
+# bench/central as the central, for the default and the streaming MTU
+# over GATT notifications, with enhanced ATT bearers and for the L2CAP
+# CoC. Prints one BENCH line per matrix point (PHY x connection interval
+# x scan rate, see bench/central/src/main.c).
+#
+#   bench/run_bsim.sh                     run and print the results
+#   bench/run_bsim.sh --save <file>       also store them as a baseline
+#   bench/run_bsim.sh --baseline <file>   exit 1 if a point lost samples
+#                                         the baseline did not, or its
+#                                         throughput dropped or its p99
+#                                         latency or slowest command
+#                                         round trip grew by more than
+#                                         THRESHOLD_PCT (default 10)
+#
+# Needs ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH as for any
+# BabbleSim build.
+
+set -euo pipefail
+
+: "${ZEPHYR_BASE:?}"
+: "${BSIM_OUT_PATH:?}"
+: "${BSIM_COMPONENTS_PATH:?}"
+
+APP_DIR=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR=${BUILD_DIR:-${APP_DIR}/build_bench}
+# The simulation runs from the BabbleSim bin directory
+case "${BUILD_DIR}" in
+/*) ;;
+*) BUILD_DIR=${PWD}/${BUILD_DIR} ;;
+esac
+THRESHOLD_PCT=${THRESHOLD_PCT:-10}
+SETTLE_MS=${SETTLE_MS:-2000}
+MEASURE_MS=${MEASURE_MS:-10000}
+# 2 PHYs x 3 intervals x 4 rates, plus link setup
+POINTS=24
+
+save=""
+baseline=""
+while [ $# -gt 0 ]; do
+	case "$1" in
+	--save) save=$2; shift 2 ;;
+	--baseline) baseline=$2; shift 2 ;;
+	*) echo "Unknown option $1" >&2; exit 2 ;;
+	esac
+done
+
+results=$(mktemp)
+trap 'rm -f "${results}"' EXIT
+
+for profile in default streaming eatt coc; do
+	overlay=()
+	case "${profile}" in
+	streaming) overlay=(-DOVERLAY_CONFIG=overlay-streaming.conf) ;;
+	eatt) overlay=("-DOVERLAY_CONFIG=overlay-streaming.conf;overlay-eatt.conf") ;;
+	coc) overlay=("-DOVERLAY_CONFIG=overlay-streaming.conf;overlay-coc.conf") ;;
+	esac
+
+	west build -p -b nrf52_bsim -d "${BUILD_DIR}/${profile}/peripheral" \
+		"${APP_DIR}" -- "${overlay[@]}"
+	west build -p -b nrf52_bsim -d "${BUILD_DIR}/${profile}/central" \
+		"${APP_DIR}/bench/central" -- "${overlay[@]}" \
+		-DCONFIG_BENCH_SETTLE_MS="${SETTLE_MS}" \
+		-DCONFIG_BENCH_MEASURE_MS="${MEASURE_MS}"
+
+	sim_id="adc_ble_bench_${profile}_$$"
+	sim_us=$(( (POINTS * (SETTLE_MS + MEASURE_MS) + 30000) * 1000 ))
+
+	# The PHY looks for its libraries next to itself
+	(cd "${BSIM_OUT_PATH}/bin" || exit 1
+	 "${BUILD_DIR}/${profile}/peripheral/zephyr/zephyr.exe" \
+		-s="${sim_id}" -d=0 > /dev/null 2>&1 &
+	 "${BUILD_DIR}/${profile}/central/zephyr/zephyr.exe" \
+		-s="${sim_id}" -d=1 | tee "${results}.${profile}" &
+	 ./bs_2G4_phy_v1 -s="${sim_id}" -D=2 -sim_length="${sim_us}" \
+		> /dev/null 2>&1 &
+	 wait)
+
+	if ! grep -q "^BENCH done" "${results}.${profile}"; then
+		echo "Benchmark did not complete (${profile})" >&2
+		rm -f "${results}.${profile}"
+		exit 1
+	fi
+
+	grep "^BENCH transport=" "${results}.${profile}" >> "${results}"
+	rm -f "${results}.${profile}"
+done
+
+echo
+cat "${results}"
+
+if [ -n "${save}" ]; then
+	cp "${results}" "${save}"
+fi
+
+if [ -n "${baseline}" ]; then
+	# Points are keyed by transport, mtu, phy, interval and rate
+	awk -v pct="${THRESHOLD_PCT}" '
+	function field(name,   i, kv) {
+		for (i = 2; i <= NF; i++) {
+			split($i, kv, "=")
+			if (kv[1] == name)
+				return kv[2]
+		}
+		return ""
+	}
+	{ key = $2 " " $3 " " $4 " " $5 " " $6 }
+	NR == FNR {
+		base_s[key] = field("samples_s")
+		base_lost[key] = field("lost")
+		base_p99[key] = field("p99_us")
+		base_ctrl[key] = field("ctrl_max_us")
+		next
+	}
+	key in base_s {
+		if (field("samples_s") + 0 < base_s[key] * (100 - pct) / 100 ||
+		    (field("lost") + 0 > 0 && base_lost[key] == 0) ||
+		    field("p99_us") + 0 > base_p99[key] * (100 + pct) / 100 ||
+		    field("ctrl_max_us") + 0 >
+		    base_ctrl[key] * (100 + pct) / 100) {
+			print "REGRESSION " $0
+			bad = 1
+		}
+	}
+	END { exit bad }
+	' "${baseline}" "${results}"
+fi
@@ -0,0 +1,274 @@
+/** @file
+ *  @brief Scripted waveforms for the emulated ADC
+ *
+ *  Feeds every zephyr,user io-channel of an adc_emul device from a value
+ *  function, so the sampling and streaming pipeline can run on a Linux
+ *  host. On native_posix the waveform is picked on the command line,
+ *  other boards always run the sine:
+ *
+ *    --wave=sine      sine around the offset, channel n shifted by n/N
+ *                     of a period (default)
+ *    --wave=ramp      sawtooth from offset - amplitude to offset +
+ *                     amplitude, shifted the same way
+ *    --wave=csv --wave-csv=<file>
+ *                     replays the Ch0..ChN columns (mV) of a CSV file
+ *                     written by csblesimp.py, one row per conversion,
+ *                     looping at the end
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+#include "soc.h"
+#include "cmdline.h"
+#endif
+
+#include "sampler.h"
+#include "adc_waveform.h"
+
+LOG_MODULE_REGISTER(adc_waveform, CONFIG_APP_LOG_LEVEL);
+
+#define PI 3.14159265358979323846
+
+enum wave {
+	WAVE_SINE,
+	WAVE_RAMP,
+	WAVE_CSV,
+};
+
+static char *wave_arg;
+static char *csv_path;
+
+static enum wave wave;
+
+static uint16_t csv_mv[CONFIG_APP_WAVE_CSV_MAX_ROWS][SAMPLER_NUM_CHANNELS];
+static size_t csv_rows;
+/* Next row replayed on every channel */
+static size_t csv_next[SAMPLER_NUM_CHANNELS];
+
+#if defined(CONFIG_BOARD_NATIVE_POSIX)
+static void add_wave_args(void)
+{
+	static struct args_struct_t wave_args[] = {
+		{ .option = "wave", .name = "sine|ramp|csv", .type = 's',
+		  .dest = (void *)&wave_arg,
+		  .descript = "Waveform on the emulated ADC channels" },
+		{ .option = "wave-csv", .name = "path", .type = 's',
+		  .dest = (void *)&csv_path,
+		  .descript = "CSV file replayed by --wave=csv" },
+		ARG_TABLE_ENDMARKER
+	};
+
+	native_add_command_line_opts(wave_args);
+}
+NATIVE_TASK(add_wave_args, PRE_BOOT_1, 20);
+#endif
+
+static uint32_t clamp_mv(double mv)
+{
+	if (mv < 0.0) {
+		return 0U;
+	}
+
+	return (uint32_t)mv;
+}
+
+/* Position inside the waveform period of channel idx, in [0, 1) */
+static double phase(size_t idx)
+{
+	double t = (double)k_uptime_ticks() / CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+	double p = t * CONFIG_APP_WAVE_FREQ_MHZ / 1000.0 +
+		   (double)idx / SAMPLER_NUM_CHANNELS;
+
+	return p - floor(p);
+}
+
+static int wave_value(const struct device *dev, unsigned int chan,
+		      void *data, uint32_t *result)
+{
+	size_t idx = (size_t)(uintptr_t)data;
+	double mv;
+
+	ARG_UNUSED(dev);
+	ARG_UNUSED(chan);
+
+	switch (wave) {
+	case WAVE_SINE:
+		mv = CONFIG_APP_WAVE_OFFSET_MV +
+		     CONFIG_APP_WAVE_AMPLITUDE_MV * sin(2.0 * PI * phase(idx));
+		break;
+	case WAVE_RAMP:
+		mv = CONFIG_APP_WAVE_OFFSET_MV +
+		     CONFIG_APP_WAVE_AMPLITUDE_MV * (2.0 * phase(idx) - 1.0);
+		break;
+	case WAVE_CSV:
+		mv = csv_mv[csv_next[idx]][idx];
+		csv_next[idx] = (csv_next[idx] + 1U) % csv_rows;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	*result = clamp_mv(mv);
+
+	return 0;
+}
+
+/* Splits line at the commas in place, empty fields included */
+static size_t split_fields(char *line, char **fields, size_t max)
+{
+	size_t n = 0U;
+
+	while (n < max) {
+		char *end = strpbrk(line, ",\r\n");
+
+		while (*line == ' ') {
+			line++;
+		}
+		fields[n++] = line;
+
+		if (end == NULL || *end != ',') {
+			if (end != NULL) {
+				*end = '\0';
+			}
+			break;
+		}
+
+		*end = '\0';
+		line = end + 1;
+	}
+
+	return n;
+}
+
+#define CSV_MAX_FIELDS 16U
+
+static int load_csv(const char *path)
+{
+	int col[SAMPLER_NUM_CHANNELS];
+	char *fields[CSV_MAX_FIELDS];
+	char line[256];
+	size_t n;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		LOG_ERR("Cannot open %s", path);
+		return -ENOENT;
+	}
+
+	/* Header row, e.g. "Date,Time,Ch0,Ch1,Ch2,Ch3," */
+	for (size_t i = 0; i < SAMPLER_NUM_CHANNELS; i++) {
+		col[i] = -1;
+	}
+
+	if (fgets(line, sizeof(line), f) != NULL) {
+		n = split_fields(line, fields, CSV_MAX_FIELDS);
+		for (size_t i = 0; i < n; i++) {
+			unsigned int ch;
+
+			if (sscanf(fields[i], "Ch%u", &ch) == 1 &&
+			    ch < SAMPLER_NUM_CHANNELS) {
+				col[ch] = i;
+			}
+		}
+	}
+
+	csv_rows = 0U;
+
+	while (csv_rows < ARRAY_SIZE(csv_mv) &&
+	       fgets(line, sizeof(line), f) != NULL) {
+		bool valid = true;
+
+		n = split_fields(line, fields, CSV_MAX_FIELDS);
+
+		/* Rows logged while the device printed text are skipped */
+		for (size_t i = 0; i < SAMPLER_NUM_CHANNELS && valid; i++) {
+			char *end;
+			long mv = 0;
+
+			if (col[i] >= 0) {
+				if ((size_t)col[i] >= n) {
+					valid = false;
+					break;
+				}
+
+				mv = strtol(fields[col[i]], &end, 10);
+				valid = end != fields[col[i]] && mv >= 0 &&
+					mv <= UINT16_MAX;
+			}
+
+			csv_mv[csv_rows][i] = mv;
+		}
+
+		if (valid) {
+			csv_rows++;
+		}
+	}
+
+	fclose(f);
+
+	if (csv_rows == 0U) {
+		LOG_ERR("No samples in %s", path);
+		return -ENODATA;
+	}
+
+	LOG_INF("Replaying %zu rows of %s", csv_rows, path);
+
+	return 0;
+}
+
+int adc_waveform_init(void)
+{
+	int err;
+
+	if (wave_arg == NULL || strcmp(wave_arg, "sine") == 0) {
+		wave = WAVE_SINE;
+	} else if (strcmp(wave_arg, "ramp") == 0) {
+		wave = WAVE_RAMP;
+	} else if (strcmp(wave_arg, "csv") == 0) {
+		wave = WAVE_CSV;
+	} else {
+		LOG_ERR("Unknown waveform %s", wave_arg);
+		return -EINVAL;
+	}
+
+	if (wave == WAVE_CSV) {
+		if (csv_path == NULL) {
+			LOG_ERR("--wave=csv needs --wave-csv=<file>");
+			return -EINVAL;
+		}
+
+		err = load_csv(csv_path);
+		if (err) {
+			return err;
+		}
+	}
+
+	for (size_t i = 0; i < SAMPLER_NUM_CHANNELS; i++) {
+		const struct adc_dt_spec *spec = sampler_channel(i);
+
+		err = adc_emul_value_func_set(spec->dev, spec->channel_id,
+					      wave_value, (void *)(uintptr_t)i);
+		if (err) {
+			LOG_ERR("Channel %zu not emulated (err %d)", i, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+/** @file
+ *  @brief Scripted waveforms for the emulated ADC
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ADC_WAVEFORM_H_
+#define ADC_WAVEFORM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Attaches the waveform chosen on the command line to every io-channel */
+int adc_waveform_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADC_WAVEFORM_H_ */
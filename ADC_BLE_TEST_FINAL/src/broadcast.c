@@ -0,0 +1,214 @@
+/** @file
+ *  @brief Sample frames in a periodic advertising train
+ *
+ *  A non-connectable extended advertising set announces the train,
+ *  scanners synchronize to it and then receive every event without a
+ *  connection, so any number of them costs the device nothing more
+ *  than one.
+ *
+ *  The sender queues frames as it builds them. Once per periodic
+ *  advertising interval the air thread moves the oldest of them into
+ *  the train's data. The data stays on air until it is replaced, so an
+ *  idle sender repeats the last frames rather than leaving events
+ *  empty; the sequence numbers tell receivers which ones they have
+ *  already seen.
+ *
+ *  Nothing is acknowledged. Frames arriving faster than
+ *  CONFIG_APP_BROADCAST_FRAMES_PER_EVENT per interval fill the queue
+ *  and are dropped.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gap.h>
+#include <zephyr/bluetooth/uuid.h>
+
+#include "broadcast.h"
+
+LOG_MODULE_REGISTER(broadcast, CONFIG_APP_LOG_LEVEL);
+
+#define FRAME_LEN CONFIG_APP_BROADCAST_FRAME_LEN
+#define FRAMES_PER_EVENT CONFIG_APP_BROADCAST_FRAMES_PER_EVENT
+#define INTERVAL_MS CONFIG_APP_BROADCAST_INTERVAL_MS
+
+/* Periodic advertising intervals are in units of 1.25 ms */
+#define INTERVAL_UNITS (INTERVAL_MS * 4U / 5U)
+
+/* The AD length byte covers the type, the header and the frame */
+BUILD_ASSERT(1U + BROADCAST_FRAME_HDR_LEN + FRAME_LEN <= UINT8_MAX);
+
+/* Every frame of an event, each with its length and type bytes, fits
+ * the controller's advertising data
+ */
+BUILD_ASSERT(FRAMES_PER_EVENT * (2U + BROADCAST_FRAME_HDR_LEN + FRAME_LEN) <=
+	     CONFIG_BT_CTLR_ADV_DATA_LEN_MAX);
+
+struct air_frame {
+	uint16_t len;
+	/* Company identifier, sequence number and frame */
+	uint8_t data[BROADCAST_FRAME_HDR_LEN + FRAME_LEN];
+};
+
+K_MSGQ_DEFINE(air_q, sizeof(struct air_frame),
+	      CONFIG_APP_BROADCAST_QUEUE_DEPTH, 4);
+
+/* Paces the data updates at the periodic advertising interval */
+K_TIMER_DEFINE(air_timer, NULL, NULL);
+
+/* Lets scanners find the train among other advertisers */
+static const struct bt_data ext_ad[] = {
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL,
+		      BT_UUID_128_ENCODE(0x6E400050, 0xB5A3, 0xF393, 0xE0A9,
+					 0xE50E24DCCA9E)),
+};
+
+static struct bt_le_ext_adv *adv;
+static atomic_t active;
+
+static atomic_t seq;
+static atomic_t aired;
+static atomic_t dropped;
+static atomic_t errors;
+
+/* Moves up to FRAMES_PER_EVENT queued frames into the train's data */
+static void air_next(void)
+{
+	static struct air_frame frames[FRAMES_PER_EVENT];
+	struct bt_data ad[FRAMES_PER_EVENT];
+	size_t count = 0U;
+	int err;
+
+	while (count < FRAMES_PER_EVENT &&
+	       k_msgq_get(&air_q, &frames[count], K_NO_WAIT) == 0) {
+		ad[count].type = BT_DATA_MANUFACTURER_DATA;
+		ad[count].data_len = frames[count].len;
+		ad[count].data = frames[count].data;
+		count++;
+	}
+
+	/* The previous frames stay on air */
+	if (count == 0U) {
+		return;
+	}
+
+	err = bt_le_per_adv_set_data(adv, ad, count);
+	if (err) {
+		LOG_ERR("Periodic advertising data failed (err %d)", err);
+		atomic_inc(&errors);
+		return;
+	}
+
+	atomic_add(&aired, count);
+}
+
+static void air_thread(void *p1, void *p2, void *p3)
+{
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	k_timer_start(&air_timer, K_MSEC(INTERVAL_MS), K_MSEC(INTERVAL_MS));
+
+	while (1) {
+		k_timer_status_sync(&air_timer);
+		air_next();
+	}
+}
+
+/* Started from broadcast_init() once the train runs */
+K_THREAD_DEFINE(air_tid, CONFIG_APP_BROADCAST_STACK_SIZE, air_thread,
+		NULL, NULL, NULL, CONFIG_APP_BROADCAST_PRIORITY, 0,
+		SYS_FOREVER_MS);
+
+int broadcast_init(void)
+{
+	int err;
+
+	err = bt_le_ext_adv_create(BT_LE_EXT_ADV_NCONN_NAME, NULL, &adv);
+	if (err) {
+		LOG_ERR("Advertising set failed (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_ext_adv_set_data(adv, ext_ad, ARRAY_SIZE(ext_ad), NULL, 0);
+	if (err) {
+		LOG_ERR("Extended advertising data failed (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_per_adv_set_param(adv,
+				      BT_LE_PER_ADV_PARAM(INTERVAL_UNITS,
+							  INTERVAL_UNITS,
+							  BT_LE_PER_ADV_OPT_NONE));
+	if (err) {
+		LOG_ERR("Periodic advertising parameters failed (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_per_adv_start(adv);
+	if (err) {
+		LOG_ERR("Periodic advertising failed to start (err %d)", err);
+		return err;
+	}
+
+	err = bt_le_ext_adv_start(adv, BT_LE_EXT_ADV_START_DEFAULT);
+	if (err) {
+		LOG_ERR("Extended advertising failed to start (err %d)", err);
+		return err;
+	}
+
+	atomic_set(&active, 1);
+	k_thread_start(air_tid);
+
+	LOG_INF("Broadcasting every %u ms, %u frames of %u bytes",
+		INTERVAL_MS, FRAMES_PER_EVENT, FRAME_LEN);
+
+	return 0;
+}
+
+bool broadcast_active(void)
+{
+	return atomic_get(&active) != 0;
+}
+
+int broadcast_send(const uint8_t *data, uint16_t len)
+{
+	struct air_frame frame;
+
+	if (len > FRAME_LEN) {
+		return -EMSGSIZE;
+	}
+
+	frame.len = BROADCAST_FRAME_HDR_LEN + len;
+	sys_put_le16(CONFIG_APP_COMPANY_ID, &frame.data[0]);
+	sys_put_le16((uint16_t)atomic_inc(&seq), &frame.data[2]);
+	memcpy(&frame.data[BROADCAST_FRAME_HDR_LEN], data, len);
+
+	/* The lost frame leaves a gap in the sequence numbers */
+	if (k_msgq_put(&air_q, &frame, K_NO_WAIT) != 0) {
+		atomic_inc(&dropped);
+		return -ENOBUFS;
+	}
+
+	return 0;
+}
+
+void broadcast_get_stats(struct broadcast_stats *stats)
+{
+	stats->aired = atomic_get(&aired);
+	stats->dropped = atomic_get(&dropped);
+	stats->errors = atomic_get(&errors);
+}
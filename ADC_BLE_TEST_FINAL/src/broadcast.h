@@ -0,0 +1,60 @@
+/** @file
+ *  @brief Sample frames in a periodic advertising train
+ *
+ *  Every periodic advertising event carries up to
+ *  CONFIG_APP_BROADCAST_FRAMES_PER_EVENT frames, each in its own
+ *  manufacturer specific data structure, little endian:
+ *
+ *    u16 company identifier (CONFIG_APP_COMPANY_ID)
+ *    u16 broadcast sequence number
+ *    sample frame, see sample_frame.h
+ *
+ *  The sequence number counts every frame offered to the train, so a
+ *  gap means frames were dropped or overwritten before being aired and
+ *  a repeated number is the same frame seen in a later event.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BROADCAST_H_
+#define BROADCAST_H_
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Company identifier and sequence number ahead of each frame */
+#define BROADCAST_FRAME_HDR_LEN 4U
+
+struct broadcast_stats {
+	/* Frames handed to the controller */
+	uint32_t aired;
+	/* Frames lost to a full queue */
+	uint32_t dropped;
+	/* Periodic advertising data updates the controller refused */
+	uint32_t errors;
+};
+
+/* Starts the extended advertising set and its periodic train */
+int broadcast_init(void);
+
+/* True once the train is running */
+bool broadcast_active(void);
+
+/* Queues a frame for the following events. Returns -EMSGSIZE if it is
+ * longer than CONFIG_APP_BROADCAST_FRAME_LEN and -ENOBUFS if the queue
+ * is full, the frame still takes a sequence number then.
+ */
+int broadcast_send(const uint8_t *data, uint16_t len);
+void broadcast_get_stats(struct broadcast_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BROADCAST_H_ */
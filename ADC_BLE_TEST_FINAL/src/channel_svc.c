@@ -0,0 +1,88 @@
+/** @file
+ *  @brief Channel selection service
+ *
+ *  Exposes the sampler's channel mask and per-channel rate divisors as
+ *  one read/write characteristic:
+ *
+ *    0      channel mask, bit n enables io-channel n
+ *    1..N   rate divisor of io-channel 0..N-1, 1 to 255
+ *
+ *  Channel n is streamed at the sample rate divided by its divisor.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/kernel.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sampler.h"
+#include "control.h"
+#include "regulator.h"
+
+struct channel_cfg {
+	uint8_t mask;
+	uint8_t divisor[SAMPLER_NUM_CHANNELS];
+} __packed;
+
+static struct bt_uuid_128 channel_svc_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400020, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 channel_cfg_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400021, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static ssize_t read_cfg(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			void *buf, uint16_t len, uint16_t offset)
+{
+	struct channel_cfg value;
+
+	sampler_get_channels(&value.mask, value.divisor);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &value,
+				 sizeof(value));
+}
+
+static ssize_t write_cfg(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			 const void *buf, uint16_t len, uint16_t offset,
+			 uint8_t flags)
+{
+	const struct channel_cfg *value = buf;
+
+	if (offset != 0U) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	if (len != sizeof(*value)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	/* Takes effect from the next scan, frames restart on the change */
+	if (!control_period_fits(sampler_get_rate(), value->mask,
+				 value->divisor) ||
+	    (IS_ENABLED(CONFIG_APP_REGULATOR) &&
+	     !regulator_allows_channels(value->mask)) ||
+	    sampler_set_channels(value->mask, value->divisor) != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	return len;
+}
+
+/* Channel Selection Service Declaration, only a paired client changes
+ * the channels
+ */
+BT_GATT_SERVICE_DEFINE(channel_svc,
+	BT_GATT_PRIMARY_SERVICE(&channel_svc_uuid),
+	BT_GATT_CHARACTERISTIC(&channel_cfg_uuid.uuid,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_ENCRYPT,
+			       read_cfg, write_cfg, NULL),
+);
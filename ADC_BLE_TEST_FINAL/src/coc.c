@@ -0,0 +1,137 @@
+/** @file
+ *  @brief L2CAP connection-oriented channel for the sample frames
+ *
+ *  A client that connects an LE credit-based channel to
+ *  CONFIG_APP_COC_PSM receives the sample frames as SDUs of up to the
+ *  channel's MTU, without an ATT header per PDU. The client grants a
+ *  credit per PDU it can take, so a slow reader holds the TX buffers
+ *  and stalls the sender instead of losing frames. GATT stays in place
+ *  for discovery, control and the other services.
+ *
+ *  One channel is served at a time.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/net/buf.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/l2cap.h>
+
+#include "stream.h"
+#include "coc.h"
+
+LOG_MODULE_REGISTER(coc, CONFIG_APP_LOG_LEVEL);
+
+#define SDU_LEN CONFIG_APP_COC_SDU_LEN
+
+NET_BUF_POOL_FIXED_DEFINE(coc_tx_pool, CONFIG_APP_COC_TX_BUFS,
+			  BT_L2CAP_SDU_BUF_SIZE(SDU_LEN),
+			  CONFIG_BT_CONN_TX_USER_DATA_SIZE, NULL);
+
+static struct bt_l2cap_le_chan coc_chan;
+static atomic_t busy;
+
+static void coc_connected(struct bt_l2cap_chan *chan)
+{
+	LOG_INF("CoC connected: MTU %u, MPS %u", coc_chan.tx.mtu,
+		coc_chan.tx.mps);
+
+	stream_set_coc(MIN(coc_chan.tx.mtu, SDU_LEN));
+}
+
+static void coc_disconnected(struct bt_l2cap_chan *chan)
+{
+	LOG_INF("CoC disconnected");
+
+	stream_set_coc(0U);
+	atomic_clear(&busy);
+}
+
+static int coc_recv(struct bt_l2cap_chan *chan, struct net_buf *buf)
+{
+	/* Nothing is expected from the client, the buffer is freed */
+	return 0;
+}
+
+static const struct bt_l2cap_chan_ops coc_ops = {
+	.connected = coc_connected,
+	.disconnected = coc_disconnected,
+	.recv = coc_recv,
+};
+
+static int coc_accept(struct bt_conn *conn, struct bt_l2cap_server *server,
+		      struct bt_l2cap_chan **chan)
+{
+	if (!atomic_cas(&busy, 0, 1)) {
+		return -ENOMEM;
+	}
+
+	/* RX MTU and credits are left to the stack defaults */
+	memset(&coc_chan, 0, sizeof(coc_chan));
+	coc_chan.chan.ops = &coc_ops;
+	*chan = &coc_chan.chan;
+
+	return 0;
+}
+
+static struct bt_l2cap_server coc_server = {
+	.psm = CONFIG_APP_COC_PSM,
+	/* Same as the CCC of the sample characteristic */
+	.sec_level = BT_SECURITY_L2,
+	.accept = coc_accept,
+};
+
+int coc_init(void)
+{
+	int err;
+
+	err = bt_l2cap_server_register(&coc_server);
+	if (err) {
+		LOG_ERR("L2CAP server registration failed (err %d)", err);
+		return err;
+	}
+
+	LOG_INF("Sample frames on PSM 0x%02x", coc_server.psm);
+
+	return 0;
+}
+
+int coc_send(const uint8_t *data, uint16_t len, k_timeout_t timeout)
+{
+	struct net_buf *buf;
+	int err;
+
+	/* A frame built for GATT before the channel came up may be larger */
+	if (len > SDU_LEN) {
+		return -EMSGSIZE;
+	}
+
+	buf = net_buf_alloc(&coc_tx_pool, timeout);
+	if (!buf) {
+		return -ENOBUFS;
+	}
+
+	net_buf_reserve(buf, BT_L2CAP_SDU_CHAN_SEND_RESERVE);
+	net_buf_add_mem(buf, data, len);
+
+	/* Queued until the client grants credits, freed once sent */
+	err = bt_l2cap_chan_send(&coc_chan.chan, buf);
+	if (err < 0) {
+		net_buf_unref(buf);
+		return err;
+	}
+
+	return 0;
+}
@@ -0,0 +1,31 @@
+/** @file
+ *  @brief L2CAP connection-oriented channel for the sample frames
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef COC_H_
+#define COC_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Registers the L2CAP server on CONFIG_APP_COC_PSM */
+int coc_init(void);
+
+/* Queues one SDU on the channel. Returns -ENOBUFS if every TX buffer
+ * is still waiting for credits when timeout expires.
+ */
+int coc_send(const uint8_t *data, uint16_t len, k_timeout_t timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COC_H_ */
@@ -0,0 +1,337 @@
+/** @file
+ *  @brief Binary control protocol
+ *
+ *  Commands are queued by the GATT write callback and executed on the
+ *  system work queue, so a slow command never holds up the Bluetooth
+ *  RX thread. The opcode indexes the handler table directly.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sampler.h"
+#include "filter.h"
+#include "sample_frame.h"
+#include "sample_ring.h"
+#include "stream.h"
+#include "link.h"
+#include "digipot.h"
+#include "regulator.h"
+#include "control.h"
+
+LOG_MODULE_REGISTER(control, CONFIG_APP_LOG_LEVEL);
+
+struct control_msg {
+	uint8_t len;
+	uint8_t data[CONTROL_MAX_LEN];
+};
+
+struct control_rsp {
+	uint8_t len;
+	uint8_t data[CONTROL_MAX_LEN - CONTROL_RSP_HDR_LEN];
+};
+
+typedef uint8_t (*control_handler_t)(const uint8_t *param, uint8_t len,
+				     struct control_rsp *rsp);
+
+struct control_cmd {
+	control_handler_t handler;
+	/* Exact parameter length */
+	uint8_t param_len;
+};
+
+static const struct bt_gatt_attr *control_attr;
+
+/* The boot configuration must fit the frame header, too */
+BUILD_ASSERT((uint64_t)(CONFIG_SYS_CLOCK_TICKS_PER_SEC /
+			CONFIG_APP_SAMPLE_RATE_HZ + 1U) *
+	     CONFIG_APP_FILTER_DECIMATION <= SAMPLE_FRAME_PERIOD_MAX,
+	     "Sample period at boot exceeds the frame header");
+
+K_MSGQ_DEFINE(control_q, sizeof(struct control_msg),
+	      CONFIG_APP_CONTROL_QUEUE_DEPTH, 4);
+
+static uint8_t cmd_start(const uint8_t *param, uint8_t len,
+			 struct control_rsp *rsp)
+{
+	if (sampler_start(sampler_get_rate()) != 0) {
+		return CONTROL_STATUS_FAILED;
+	}
+
+	link_update_profile();
+
+	return CONTROL_STATUS_OK;
+}
+
+static uint8_t cmd_stop(const uint8_t *param, uint8_t len,
+			struct control_rsp *rsp)
+{
+	sampler_stop();
+	link_update_profile();
+
+	return CONTROL_STATUS_OK;
+}
+
+static uint8_t cmd_set_rate(const uint8_t *param, uint8_t len,
+			    struct control_rsp *rsp)
+{
+	uint8_t divisor[SAMPLER_NUM_CHANNELS];
+	uint16_t rate = sys_get_le16(param);
+	uint8_t mask;
+
+	sampler_get_channels(&mask, divisor);
+	if (!control_period_fits(rate, mask, divisor)) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	}
+
+	if (sampler_set_rate(rate) != 0) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	}
+
+	link_update_profile();
+
+	return CONTROL_STATUS_OK;
+}
+
+static uint8_t cmd_set_channels(const uint8_t *param, uint8_t len,
+				struct control_rsp *rsp)
+{
+	if (!control_period_fits(sampler_get_rate(), param[0], &param[1])) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	}
+
+	/* The running loop keeps its sense channel */
+	if (IS_ENABLED(CONFIG_APP_REGULATOR) &&
+	    !regulator_allows_channels(param[0])) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	}
+
+	if (sampler_set_channels(param[0], &param[1]) != 0) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	}
+
+	return CONTROL_STATUS_OK;
+}
+
+static uint8_t cmd_get_stats(const uint8_t *param, uint8_t len,
+			     struct control_rsp *rsp)
+{
+	struct sampler_stats sampler;
+	struct sample_ring_stats ring;
+	struct stream_stats stream;
+
+	sampler_get_stats(&sampler);
+	sample_ring_get_stats(&ring);
+	stream_get_stats(&stream);
+
+	sys_put_le32(sampler.scans, &rsp->data[0]);
+	sys_put_le32(ring.overflows, &rsp->data[4]);
+	sys_put_le32(stream.sent, &rsp->data[8]);
+	sys_put_le32(stream.dropped, &rsp->data[12]);
+	rsp->len = 16U;
+
+	return CONTROL_STATUS_OK;
+}
+
+#if defined(CONFIG_APP_DIGIPOT)
+/* A manual setting overrides closed-loop regulation */
+static void stop_regulation(void)
+{
+	if (IS_ENABLED(CONFIG_APP_REGULATOR)) {
+		(void)regulator_set_setpoint(0U);
+	}
+}
+
+static uint8_t cmd_set_wiper(const uint8_t *param, uint8_t len,
+			     struct control_rsp *rsp)
+{
+	stop_regulation();
+
+	if (digipot_set_wiper(param[0]) != 0) {
+		return CONTROL_STATUS_FAILED;
+	}
+
+	return CONTROL_STATUS_OK;
+}
+
+static uint8_t cmd_set_current(const uint8_t *param, uint8_t len,
+			       struct control_rsp *rsp)
+{
+	int err;
+
+	stop_regulation();
+
+	err = digipot_set_current(sys_get_le16(param));
+	if (err == -ERANGE) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	} else if (err) {
+		return CONTROL_STATUS_FAILED;
+	}
+
+	rsp->data[0] = digipot_get_wiper();
+	rsp->len = 1U;
+
+	return CONTROL_STATUS_OK;
+}
+#endif /* CONFIG_APP_DIGIPOT */
+
+#if defined(CONFIG_APP_REGULATOR)
+static uint8_t cmd_set_setpoint(const uint8_t *param, uint8_t len,
+				struct control_rsp *rsp)
+{
+	int err;
+
+	err = regulator_set_setpoint(sys_get_le16(param));
+	if (err == -ERANGE) {
+		return CONTROL_STATUS_INVALID_PARAM;
+	} else if (err) {
+		return CONTROL_STATUS_FAILED;
+	}
+
+	return CONTROL_STATUS_OK;
+}
+#endif /* CONFIG_APP_REGULATOR */
+
+/* Indexed by opcode */
+static const struct control_cmd commands[CONTROL_OP_COUNT] = {
+	[CONTROL_OP_START] = { cmd_start, 0U },
+	[CONTROL_OP_STOP] = { cmd_stop, 0U },
+	[CONTROL_OP_SET_RATE] = { cmd_set_rate, 2U },
+	[CONTROL_OP_SET_CHANNELS] = { cmd_set_channels,
+				      1U + SAMPLER_NUM_CHANNELS },
+	[CONTROL_OP_GET_STATS] = { cmd_get_stats, 0U },
+#if defined(CONFIG_APP_DIGIPOT)
+	[CONTROL_OP_SET_WIPER] = { cmd_set_wiper, 1U },
+	[CONTROL_OP_SET_CURRENT] = { cmd_set_current, 2U },
+#endif
+#if defined(CONFIG_APP_REGULATOR)
+	[CONTROL_OP_SET_SETPOINT] = { cmd_set_setpoint, 2U },
+#endif
+};
+
+static uint8_t dispatch(const struct control_msg *msg,
+			struct control_rsp *rsp)
+{
+	uint8_t opcode = msg->data[0];
+	uint8_t len = msg->len - CONTROL_REQ_HDR_LEN;
+	const struct control_cmd *cmd;
+
+	if (opcode == 0U || opcode >= ARRAY_SIZE(commands)) {
+		return CONTROL_STATUS_UNKNOWN_OPCODE;
+	}
+
+	/* Known, but its hardware is not part of this build */
+	if (!commands[opcode].handler) {
+		return CONTROL_STATUS_UNSUPPORTED;
+	}
+
+	cmd = &commands[opcode];
+	if (len != cmd->param_len) {
+		return CONTROL_STATUS_INVALID_LENGTH;
+	}
+
+	return cmd->handler(&msg->data[CONTROL_REQ_HDR_LEN], len, rsp);
+}
+
+static void control_handler(struct k_work *work)
+{
+	struct control_msg msg;
+	struct control_rsp rsp;
+	uint8_t out[CONTROL_MAX_LEN];
+	struct bt_gatt_notify_params params = {
+		.attr = control_attr,
+		.data = out,
+	};
+	uint8_t status;
+	int err;
+
+	while (k_msgq_get(&control_q, &msg, K_NO_WAIT) == 0) {
+		rsp.len = 0U;
+		status = dispatch(&msg, &rsp);
+
+		LOG_INF("Command 0x%02x: status %u", msg.data[0], status);
+
+		out[0] = msg.data[0] | CONTROL_RESPONSE;
+		out[1] = msg.data[1];
+		out[2] = status;
+		memcpy(&out[CONTROL_RSP_HDR_LEN], rsp.data, rsp.len);
+
+		params.len = CONTROL_RSP_HDR_LEN + rsp.len;
+#if defined(CONFIG_BT_EATT)
+		params.chan_opt = link_bearer(LINK_TRAFFIC_CONTROL);
+#endif
+
+		/* The acknowledgment reaches every subscribed client */
+		err = bt_gatt_notify_cb(NULL, &params);
+		if (err && err != -ENOTCONN) {
+			LOG_WRN("Response to 0x%02x lost (err %d)",
+				msg.data[0], err);
+		}
+	}
+}
+
+static K_WORK_DEFINE(control_work, control_handler);
+
+bool control_period_fits(uint32_t rate_hz, uint8_t mask,
+			 const uint8_t *divisor)
+{
+	uint8_t max_div = 1U;
+	uint64_t period;
+
+	if (rate_hz == 0U) {
+		return false;
+	}
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		if (mask & BIT(i)) {
+			max_div = MAX(max_div, divisor[i]);
+		}
+	}
+
+	/* Rounded up to whole ticks as the sampler does */
+	period = (uint64_t)k_us_to_ticks_ceil32(USEC_PER_SEC / rate_hz) *
+		 filter_get_decimation() * max_div;
+
+	return period <= SAMPLE_FRAME_PERIOD_MAX;
+}
+
+int control_receive(const void *buf, uint16_t len)
+{
+	struct control_msg msg;
+
+	if (len < CONTROL_REQ_HDR_LEN || len > CONTROL_MAX_LEN) {
+		return -EINVAL;
+	}
+
+	msg.len = (uint8_t)len;
+	memcpy(msg.data, buf, len);
+
+	if (k_msgq_put(&control_q, &msg, K_NO_WAIT) != 0) {
+		LOG_WRN("Control queue full, command 0x%02x dropped",
+			msg.data[0]);
+		return -ENOMEM;
+	}
+
+	k_work_submit(&control_work);
+
+	return 0;
+}
+
+void control_init(const struct bt_gatt_attr *attr)
+{
+	control_attr = attr;
+}
@@ -0,0 +1,83 @@
+/** @file
+ *  @brief Binary control protocol
+ *
+ *  Commands are written without response to the control characteristic
+ *  and answered by a notification on the same characteristic, all
+ *  fields little endian:
+ *
+ *    request   opcode, token, parameters
+ *    response  opcode | CONTROL_RESPONSE, token, status, results
+ *
+ *  The token is echoed so the client can match responses to requests.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fits a write and a notification at the default ATT MTU */
+#define CONTROL_MAX_LEN 20U
+#define CONTROL_REQ_HDR_LEN 2U
+#define CONTROL_RSP_HDR_LEN 3U
+
+#define CONTROL_RESPONSE 0x80U
+
+enum control_opcode {
+	/* No parameters */
+	CONTROL_OP_START = 0x01,
+	/* No parameters */
+	CONTROL_OP_STOP = 0x02,
+	/* u16 scan rate in Hz */
+	CONTROL_OP_SET_RATE = 0x03,
+	/* u8 channel mask, u8 rate divisor per channel */
+	CONTROL_OP_SET_CHANNELS = 0x04,
+	/* u8 DigiPot wiper code */
+	CONTROL_OP_SET_WIPER = 0x05,
+	/* Returns u32 scans, ring overflows, frames sent, samples dropped */
+	CONTROL_OP_GET_STATS = 0x06,
+	/* u16 current amplitude in uA, returns the u8 wiper code */
+	CONTROL_OP_SET_CURRENT = 0x07,
+	/* u16 regulation setpoint in uA, 0 stops the loop */
+	CONTROL_OP_SET_SETPOINT = 0x08,
+
+	CONTROL_OP_COUNT,
+};
+
+enum control_status {
+	CONTROL_STATUS_OK = 0x00,
+	CONTROL_STATUS_UNKNOWN_OPCODE = 0x01,
+	CONTROL_STATUS_INVALID_LENGTH = 0x02,
+	CONTROL_STATUS_INVALID_PARAM = 0x03,
+	CONTROL_STATUS_UNSUPPORTED = 0x04,
+	CONTROL_STATUS_FAILED = 0x05,
+};
+
+/* attr is the control characteristic value, responses are notified on it */
+void control_init(const struct bt_gatt_attr *attr);
+
+/* Queues a command received on the control characteristic. Safe to call
+ * from the GATT write callback, returns -ENOMEM if the queue is full.
+ */
+int control_receive(const void *buf, uint16_t len);
+
+/* True if the sample frame header can carry the period of every channel
+ * in mask at rate_hz with the given divisors and the current decimation
+ */
+bool control_period_fits(uint32_t rate_hz, uint8_t mask,
+			 const uint8_t *divisor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTROL_H_ */
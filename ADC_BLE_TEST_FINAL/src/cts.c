@@ -1,5 +1,9 @@
 /** @file
  *  @brief CTS Service sample
+ *
+ *  The current time is kept as an offset between the kernel uptime and
+ *  the time a client last wrote, so reads always return the live time
+ *  and sample timestamps can be converted without another round trip.
  */
 
 /*
@@ -12,8 +16,10 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
-#include <zephyr/sys/printk.h>
+#include <time.h>
+#include <zephyr/logging/log.h>
 #include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/timeutil.h>
 #include <zephyr/kernel.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
@@ -22,35 +28,163 @@
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/gatt.h>
 
-static uint8_t ct[10];
+#include "cts.h"
+#include "link.h"
+#include "sample_frame.h"
+
+LOG_MODULE_REGISTER(cts, CONFIG_APP_LOG_LEVEL);
+
+/* 'Exact Time 256' followed by 'Adjust Reason' */
+#define CT_LEN 10U
+#define CT_ADJUST_MANUAL BIT(0)
+#define CT_YEAR_MIN 1582U
+#define CT_YEAR_MAX 9999U
+
+/* Ticks per 1/256 s fraction are not whole, scale before dividing */
+#define FRACTIONS_PER_SEC 256U
+
+static struct k_spinlock clock_lock;
+/* Local time at uptime zero, in kernel ticks since 1970-01-01 */
+static int64_t epoch_ticks;
+static bool clock_set;
+static uint8_t adjust_reason;
+
 static uint8_t ct_update;
 
+static void ct_notify_handler(struct k_work *work)
+{
+	cts_notify();
+}
+
+static K_WORK_DEFINE(ct_notify_work, ct_notify_handler);
+
 static void ct_ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
 {
 	/* TODO: Handle value */
 }
 
+static void generate_current_time(uint8_t *buf)
+{
+	struct tm tm;
+	time_t secs;
+	int64_t now;
+	uint16_t year;
+
+	memset(buf, 0, CT_LEN);
+
+	/* Year, month and day 0 mean unknown until a client sets the time */
+	if (cts_epoch_offset(&now) != 0) {
+		return;
+	}
+
+	now += k_uptime_ticks();
+	secs = (time_t)(now / CONFIG_SYS_CLOCK_TICKS_PER_SEC);
+	if (gmtime_r(&secs, &tm) == NULL) {
+		return;
+	}
+
+	/* 'Exact Time 256' contains 'Day Date Time' which contains
+	 * 'Date Time' - characteristic contains fields for:
+	 * year, month, day, hours, minutes and seconds.
+	 */
+
+	year = sys_cpu_to_le16(tm.tm_year + 1900);
+	memcpy(buf,  &year, 2); /* year */
+	buf[2] = tm.tm_mon + 1; /* months starting from 1 */
+	buf[3] = tm.tm_mday; /* day */
+	buf[4] = tm.tm_hour; /* hours */
+	buf[5] = tm.tm_min; /* minutes */
+	buf[6] = tm.tm_sec; /* seconds */
+
+	/* 'Day of Week' part of 'Day Date Time', Monday is 1 */
+	buf[7] = (tm.tm_wday + 6) % 7 + 1;
+
+	/* 'Fractions 256 part of 'Exact Time 256' */
+	buf[8] = (now % CONFIG_SYS_CLOCK_TICKS_PER_SEC) * FRACTIONS_PER_SEC /
+		 CONFIG_SYS_CLOCK_TICKS_PER_SEC;
+
+	/* Adjust reason */
+	buf[9] = adjust_reason;
+}
+
+/* Converts a written 'Exact Time 256' to ticks since 1970-01-01 */
+static int parse_current_time(const uint8_t *buf, int64_t *ticks)
+{
+	struct tm tm = { 0 };
+	uint16_t year = sys_get_le16(buf);
+
+	if (year < CT_YEAR_MIN || year > CT_YEAR_MAX ||
+	    buf[2] < 1U || buf[2] > 12U || buf[3] < 1U || buf[3] > 31U ||
+	    buf[4] > 23U || buf[5] > 59U || buf[6] > 59U) {
+		return -EINVAL;
+	}
+
+	tm.tm_year = year - 1900;
+	tm.tm_mon = buf[2] - 1;
+	tm.tm_mday = buf[3];
+	tm.tm_hour = buf[4];
+	tm.tm_min = buf[5];
+	tm.tm_sec = buf[6];
+
+	*ticks = timeutil_timegm64(&tm) * CONFIG_SYS_CLOCK_TICKS_PER_SEC +
+		 (int64_t)buf[8] * CONFIG_SYS_CLOCK_TICKS_PER_SEC /
+		 FRACTIONS_PER_SEC;
+
+	return 0;
+}
+
 static ssize_t read_ct(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 		       void *buf, uint16_t len, uint16_t offset)
 {
-	const char *value = attr->user_data;
+	uint8_t value[CT_LEN];
+
+	generate_current_time(value);
 
 	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
-				 sizeof(ct));
+				 sizeof(value));
 }
 
 static ssize_t write_ct(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 			const void *buf, uint16_t len, uint16_t offset,
 			uint8_t flags)
 {
-	uint8_t *value = attr->user_data;
+	k_spinlock_key_t key;
+	int64_t ticks;
 
-	if (offset + len > sizeof(ct)) {
+	if (offset != 0U) {
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 	}
 
-	memcpy(value + offset, buf, len);
+	if (len != CT_LEN) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	if (parse_current_time(buf, &ticks) != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	/* Frames carry unsigned 56-bit timestamps, at 32768 Hz that is
+	 * 1970 to 2039. Any other time could stamp no frame at all.
+	 */
+	if (ticks < 0 ||
+	    ticks > (int64_t)SAMPLE_FRAME_TICKS_MAX - k_uptime_ticks()) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	key = k_spin_lock(&clock_lock);
+	/* The write was received now, the offset pins it to the uptime */
+	epoch_ticks = ticks - k_uptime_ticks();
+	clock_set = true;
+	adjust_reason = CT_ADJUST_MANUAL;
+	k_spin_unlock(&clock_lock, key);
+
+	LOG_INF("Current time set to %04u-%02u-%02u %02u:%02u:%02u",
+		sys_get_le16(buf), ((const uint8_t *)buf)[2],
+		((const uint8_t *)buf)[3], ((const uint8_t *)buf)[4],
+		((const uint8_t *)buf)[5], ((const uint8_t *)buf)[6]);
+
 	ct_update = 1U;
+	k_work_submit(&ct_notify_work);
 
 	return len;
 }
@@ -61,49 +195,54 @@ BT_GATT_SERVICE_DEFINE(cts_cvs,
 	BT_GATT_CHARACTERISTIC(BT_UUID_CTS_CURRENT_TIME, BT_GATT_CHRC_READ |
 			       BT_GATT_CHRC_NOTIFY | BT_GATT_CHRC_WRITE,
 			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
-			       read_ct, write_ct, ct),
+			       read_ct, write_ct, NULL),
 	BT_GATT_CCC(ct_ccc_cfg_changed, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
 );
 
-static void generate_current_time(uint8_t *buf)
+int cts_epoch_offset(int64_t *offset)
 {
-	uint16_t year;
-
-	/* 'Exact Time 256' contains 'Day Date Time' which contains
-	 * 'Date Time' - characteristic contains fields for:
-	 * year, month, day, hours, minutes and seconds.
-	 */
-
-	year = sys_cpu_to_le16(2015);
-	memcpy(buf,  &year, 2); /* year */
-	buf[2] = 5U; /* months starting from 1 */
-	buf[3] = 30U; /* day */
-	buf[4] = 12U; /* hours */
-	buf[5] = 45U; /* minutes */
-	buf[6] = 30U; /* seconds */
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+	int err = 0;
 
-	/* 'Day of Week' part of 'Day Date Time' */
-	buf[7] = 1U; /* day of week starting from 1 */
+	if (clock_set) {
+		*offset = epoch_ticks;
+	} else {
+		err = -ENODATA;
+	}
 
-	/* 'Fractions 256 part of 'Exact Time 256' */
-	buf[8] = 0U;
+	k_spin_unlock(&clock_lock, key);
 
-	/* Adjust reason */
-	buf[9] = 0U; /* No update, change, etc */
+	return err;
 }
 
 void cts_init(void)
 {
-	/* Simulate current time for Current Time Service */
-	generate_current_time(ct);
+	k_spinlock_key_t key = k_spin_lock(&clock_lock);
+
+	/* The clock runs from the uptime and stays unset until written */
+	clock_set = false;
+	adjust_reason = 0U;
+
+	k_spin_unlock(&clock_lock, key);
 }
 
 void cts_notify(void)
 {	/* Current Time Service updates only when time is changed */
+	uint8_t ct[CT_LEN];
+	struct bt_gatt_notify_params params = {
+		.attr = &cts_cvs.attrs[1],
+		.data = ct,
+		.len = sizeof(ct),
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_CONTROL),
+#endif
+	};
+
 	if (!ct_update) {
 		return;
 	}
 
 	ct_update = 0U;
-	bt_gatt_notify(NULL, &cts_cvs.attrs[1], &ct, sizeof(ct));
+	generate_current_time(ct);
+	(void)bt_gatt_notify_cb(NULL, &params);
 }
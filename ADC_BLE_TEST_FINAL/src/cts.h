@@ -8,6 +8,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include <zephyr/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,6 +17,13 @@ extern "C" {
 void cts_init(void);
 void cts_notify(void);
 
+/* Gets the current time at uptime zero, in kernel ticks since
+ * 1970-01-01 00:00:00 of the time zone the client wrote. Adding it to
+ * k_uptime_ticks() gives the current time. Returns -ENODATA until a
+ * client has set the time.
+ */
+int cts_epoch_offset(int64_t *offset);
+
 #ifdef __cplusplus
 }
 #endif
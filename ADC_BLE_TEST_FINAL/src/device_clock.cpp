@@ -0,0 +1,63 @@
+/** @file
+ *  @brief Device clock reconstruction
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "device_clock.h"
+
+DeviceClock::DeviceClock(double tick_hz, double window_s, size_t max_windows)
+	: tick_hz(tick_hz), window_s(window_s), max_windows(max_windows)
+{
+}
+
+void DeviceClock::observe(uint64_t ticks, double arrival)
+{
+	double device_s = ticks / tick_hz;
+	double offset = arrival - device_s;
+
+	if (!points.empty() && device_s - points.back().device_s < window_s) {
+		if (offset < points.back().offset) {
+			points.back() = { device_s, offset };
+		}
+		return;
+	}
+
+	points.push_back({ device_s, offset });
+	while (points.size() > max_windows) {
+		points.pop_front();
+	}
+}
+
+std::optional<double> DeviceClock::to_wall(uint64_t ticks) const
+{
+	double device_s = ticks / tick_hz;
+	double mean_x = 0.0;
+	double mean_y = 0.0;
+	double sxx = 0.0;
+	double sxy = 0.0;
+
+	if (points.empty()) {
+		return std::nullopt;
+	}
+
+	/* Least squares fit of offset = a + b * device_s */
+	for (const auto &p : points) {
+		mean_x += p.device_s;
+		mean_y += p.offset;
+	}
+	mean_x /= points.size();
+	mean_y /= points.size();
+
+	for (const auto &p : points) {
+		sxx += (p.device_s - mean_x) * (p.device_s - mean_x);
+		sxy += (p.device_s - mean_x) * (p.offset - mean_y);
+	}
+
+	/* A single window gives the offset only */
+	double drift = sxx > 0.0 ? sxy / sxx : 0.0;
+
+	return device_s + mean_y + drift * (device_s - mean_x);
+}
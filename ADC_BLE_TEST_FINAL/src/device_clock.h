@@ -0,0 +1,59 @@
+/** @file
+ *  @brief Device clock reconstruction
+ *
+ *  Host side only. Maps device timestamps in kernel ticks since boot
+ *  to host wall clock time, with the drift of the device crystal
+ *  against the host clock corrected.
+ *
+ *  A frame reaches the host some unknown BLE, scheduler or flash delay
+ *  after its first sample was taken, so (arrival - device time) is the
+ *  clock offset plus a delay that is never negative. Per window only
+ *  the smallest of these is kept, and a least squares line through
+ *  them gives the offset and the drift.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DEVICE_CLOCK_H_
+#define DEVICE_CLOCK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+class DeviceClock {
+public:
+	/* tick_hz is CONFIG_SYS_CLOCK_TICKS_PER_SEC of the firmware build.
+	 * Observations less than window_s apart share a window, the
+	 * newest max_windows windows are fitted.
+	 */
+	explicit DeviceClock(double tick_hz, double window_s = 10.0,
+			     size_t max_windows = 60);
+
+	/* Adds a device timestamp and the host time in seconds at which
+	 * it arrived. Timestamps must not go backwards.
+	 */
+	void observe(uint64_t ticks, double arrival);
+
+	/* Host time in seconds of a device timestamp, none before the
+	 * first observation
+	 */
+	std::optional<double> to_wall(uint64_t ticks) const;
+
+private:
+	struct Point {
+		double device_s;
+		/* Smallest arrival - device time of the window */
+		double offset;
+	};
+
+	double tick_hz;
+	double window_s;
+	size_t max_windows;
+	std::deque<Point> points;
+};
+
+#endif /* DEVICE_CLOCK_H_ */
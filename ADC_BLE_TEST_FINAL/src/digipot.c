@@ -0,0 +1,128 @@
+/** @file
+ *  @brief SPI DigiPot setting the current source amplitude
+ *
+ *  The output current is the wiper voltage across the sense resistor,
+ *  so the wiper code for I uA is I * Rsense * 256 / full scale, worked
+ *  out in integer uV. The last code written is cached and only changes
+ *  go out on the bus.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/spi.h>
+
+#include "digipot.h"
+
+LOG_MODULE_REGISTER(digipot, CONFIG_APP_LOG_LEVEL);
+
+#define DIGIPOT_NODE DT_COMPAT_GET_ANY_STATUS_OKAY(chinch_digipot)
+
+#if !DT_NODE_EXISTS(DIGIPOT_NODE)
+#error "No chinch,digipot node in the devicetree"
+#endif
+
+/* Mode 0, MSB first, as the Arduino SPI defaults */
+#define DIGIPOT_SPI_OP (SPI_OP_MODE_MASTER | SPI_WORD_SET(8) | SPI_TRANSFER_MSB)
+
+#define FULL_SCALE_UV ((uint64_t)DT_PROP(DIGIPOT_NODE, full_scale_mv) * 1000U)
+#define RSENSE_OHMS DT_PROP(DIGIPOT_NODE, rsense_ohms)
+#define CODE_STEPS 256U
+
+static const struct spi_dt_spec bus = SPI_DT_SPEC_GET(DIGIPOT_NODE,
+						      DIGIPOT_SPI_OP, 0);
+
+static K_MUTEX_DEFINE(pot_lock);
+static uint8_t wiper;
+/* Nothing has been written since boot, the wiper state is unknown */
+static bool wiper_valid;
+
+int digipot_set_wiper(uint8_t code)
+{
+	struct spi_buf buf = { .buf = &code, .len = sizeof(code) };
+	struct spi_buf_set tx = { .buffers = &buf, .count = 1U };
+	int err = 0;
+
+	k_mutex_lock(&pot_lock, K_FOREVER);
+
+	if (!wiper_valid || code != wiper) {
+		err = spi_write_dt(&bus, &tx);
+		if (err) {
+			LOG_ERR("Wiper write failed (err %d)", err);
+			wiper_valid = false;
+		} else {
+			wiper = code;
+			wiper_valid = true;
+		}
+	}
+
+	k_mutex_unlock(&pot_lock);
+
+	return err;
+}
+
+uint8_t digipot_get_wiper(void)
+{
+	return wiper;
+}
+
+int digipot_ua_to_code(uint32_t ua, uint8_t *code)
+{
+	/* uA * ohm is uV, rounded to the nearest step */
+	uint64_t scaled = (uint64_t)ua * RSENSE_OHMS * CODE_STEPS;
+	uint64_t val = (scaled + FULL_SCALE_UV / 2U) / FULL_SCALE_UV;
+
+	if (val > DIGIPOT_CODE_MAX) {
+		return -ERANGE;
+	}
+
+	*code = (uint8_t)val;
+
+	return 0;
+}
+
+int digipot_set_current(uint32_t ua)
+{
+	uint8_t code;
+	int err;
+
+	err = digipot_ua_to_code(ua, &code);
+	if (err) {
+		return err;
+	}
+
+	return digipot_set_wiper(code);
+}
+
+uint32_t digipot_rsense_ohms(void)
+{
+	return RSENSE_OHMS;
+}
+
+int digipot_init(void)
+{
+	int err;
+
+	if (!spi_is_ready_dt(&bus)) {
+		LOG_ERR("SPI bus %s not ready", bus.bus->name);
+		return -ENODEV;
+	}
+
+	err = digipot_set_current(CONFIG_APP_DIGIPOT_CURRENT_UA);
+	if (err) {
+		return err;
+	}
+
+	LOG_INF("DigiPot wiper %u for %u uA", wiper,
+		CONFIG_APP_DIGIPOT_CURRENT_UA);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/** @file
+ *  @brief SPI DigiPot setting the current source amplitude
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef DIGIPOT_H_
+#define DIGIPOT_H_
+
+#include <zephyr/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIGIPOT_CODE_MAX UINT8_MAX
+
+int digipot_init(void);
+
+/* Writes the wiper code, skipping the SPI transfer if it is unchanged */
+int digipot_set_wiper(uint8_t code);
+uint8_t digipot_get_wiper(void);
+
+/* Wiper code for a current amplitude, -ERANGE if it is out of reach */
+int digipot_ua_to_code(uint32_t ua, uint8_t *code);
+
+/* Sets the wiper for a current amplitude in uA */
+int digipot_set_current(uint32_t ua);
+
+/* Nominal sense resistor from the devicetree */
+uint32_t digipot_rsense_ohms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DIGIPOT_H_ */
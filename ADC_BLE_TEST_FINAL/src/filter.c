@@ -0,0 +1,233 @@
+/** @file
+ *  @brief Per-channel decimation and low-pass filter stage
+ *
+ *  Sits between the sampler and the sample ring. Scans are grouped in
+ *  windows of the decimation factor, aligned to the scan sequence
+ *  number, and every window yields one sample per channel: the window
+ *  mean (a first order CIC) or its last scan. An optional first order
+ *  IIR low-pass then runs on the decimated samples. Everything is
+ *  integer arithmetic.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+#include "sampler.h"
+#include "filter.h"
+
+LOG_MODULE_REGISTER(filter, CONFIG_APP_LOG_LEVEL);
+
+/* Fractional bits kept in the IIR state */
+#define IIR_FRAC_BITS 8U
+
+static struct k_spinlock lock;
+
+static uint32_t decimation;
+static uint8_t chan_flags[SAMPLER_NUM_CHANNELS];
+
+/* Window in progress */
+static bool window_open;
+static uint32_t window_seq;
+static uint32_t window_period;
+static int64_t window_ticks;
+static uint8_t window_mask;
+static uint8_t window_divisor[SAMPLER_NUM_CHANNELS];
+static uint32_t window_count;
+static int32_t sum[SAMPLER_NUM_CHANNELS];
+static int16_t last[SAMPLER_NUM_CHANNELS];
+
+/* Channels whose IIR state holds a previous output */
+static uint8_t iir_valid;
+static int32_t iir[SAMPLER_NUM_CHANNELS];
+
+/* Called with lock held */
+static void filter_reset(void)
+{
+	window_open = false;
+	iir_valid = 0U;
+}
+
+/* Called with lock held */
+static void window_start(const struct sampler_scan *in)
+{
+	uint32_t slot = in->seq % decimation;
+
+	window_open = true;
+	window_seq = in->seq - slot;
+	window_period = in->period_ticks;
+	/* Scans lost at the start of the window do not move its timestamp */
+	window_ticks = in->ticks - (int64_t)slot * in->period_ticks;
+	window_mask = in->mask;
+	memcpy(window_divisor, in->divisor, sizeof(window_divisor));
+	window_count = 0U;
+	memset(sum, 0, sizeof(sum));
+}
+
+/* Called with lock held */
+static void window_finish(struct sampler_scan *out)
+{
+	window_open = false;
+
+	out->seq = window_seq / decimation;
+	out->period_ticks = window_period * decimation;
+	out->ticks = window_ticks +
+		     (int64_t)window_period * (decimation - 1U) / 2U;
+	out->mask = window_mask;
+	memcpy(out->divisor, window_divisor, sizeof(out->divisor));
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		int32_t val = last[i];
+
+		if (!(window_mask & BIT(i))) {
+			out->raw[i] = 0;
+			continue;
+		}
+
+		if (chan_flags[i] & FILTER_BOXCAR) {
+			val = (sum[i] + (int32_t)window_count / 2) /
+			      (int32_t)window_count;
+		}
+
+		if (chan_flags[i] & FILTER_IIR) {
+			int32_t x = val * (1 << IIR_FRAC_BITS);
+
+			if (iir_valid & BIT(i)) {
+				iir[i] += (x - iir[i]) >>
+					  CONFIG_APP_FILTER_IIR_SHIFT;
+			} else {
+				iir[i] = x;
+			}
+
+			val = (iir[i] + (1 << (IIR_FRAC_BITS - 1U))) >>
+			      IIR_FRAC_BITS;
+		}
+
+		out->raw[i] = (int16_t)val;
+	}
+
+	iir_valid |= window_mask;
+}
+
+bool filter_process(const struct sampler_scan *in, struct sampler_scan *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	bool ready = false;
+
+	/* A new rate restarts the filter, old and new samples never mix */
+	if (window_open && in->period_ticks != window_period) {
+		filter_reset();
+	}
+
+	/* The channel selection changed, the partial window is dropped */
+	if (window_open && in->mask != window_mask) {
+		window_open = false;
+	}
+
+	/* The window's last scan was lost, send what it has */
+	if (window_open && in->seq - window_seq >= decimation) {
+		window_finish(out);
+		ready = true;
+	}
+
+	if (!window_open) {
+		window_start(in);
+	}
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		if (in->mask & BIT(i)) {
+			sum[i] += in->raw[i];
+			last[i] = in->raw[i];
+		}
+	}
+	window_count++;
+
+	/* At most one output per scan, a complete window can wait a scan */
+	if (!ready && in->seq - window_seq == decimation - 1U) {
+		window_finish(out);
+		ready = true;
+	}
+
+	k_spin_unlock(&lock, key);
+
+	return ready;
+}
+
+int filter_set_decimation(uint32_t factor)
+{
+	k_spinlock_key_t key;
+
+	if (factor < 1U || factor > FILTER_DECIMATION_MAX) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&lock);
+	decimation = factor;
+	filter_reset();
+	k_spin_unlock(&lock, key);
+
+	/* Keep the channel selection constant within every window */
+	return sampler_set_window(factor);
+}
+
+uint32_t filter_get_decimation(void)
+{
+	return decimation;
+}
+
+int filter_set_channel(size_t idx, uint8_t flags)
+{
+	k_spinlock_key_t key;
+
+	if (idx >= SAMPLER_NUM_CHANNELS ||
+	    (flags & ~(FILTER_BOXCAR | FILTER_IIR))) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&lock);
+	chan_flags[idx] = flags;
+	filter_reset();
+	k_spin_unlock(&lock, key);
+
+	return 0;
+}
+
+uint8_t filter_get_channel(size_t idx)
+{
+	if (idx >= SAMPLER_NUM_CHANNELS) {
+		return 0U;
+	}
+
+	return chan_flags[idx];
+}
+
+void filter_init(void)
+{
+	(void)filter_set_decimation(CONFIG_APP_FILTER_DECIMATION);
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		uint8_t flags = 0U;
+
+		if (CONFIG_APP_FILTER_BOXCAR_CHANNELS & BIT(i)) {
+			flags |= FILTER_BOXCAR;
+		}
+
+		if (CONFIG_APP_FILTER_IIR_CHANNELS & BIT(i)) {
+			flags |= FILTER_IIR;
+		}
+
+		(void)filter_set_channel(i, flags);
+	}
+
+	LOG_INF("Decimation %u, boxcar 0x%02x, IIR 0x%02x",
+		decimation, CONFIG_APP_FILTER_BOXCAR_CHANNELS,
+		CONFIG_APP_FILTER_IIR_CHANNELS);
+}
@@ -0,0 +1,48 @@
+/** @file
+ *  @brief Per-channel decimation and low-pass filter stage
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <zephyr/types.h>
+#include <zephyr/sys/util.h>
+
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FILTER_DECIMATION_MAX 256U
+
+/* Per-channel filter selection */
+#define FILTER_BOXCAR BIT(0)
+#define FILTER_IIR BIT(1)
+
+void filter_init(void);
+
+/* Changing the factor drops the window in progress. The sampler keeps
+ * its channel selection constant over windows of the same length.
+ */
+int filter_set_decimation(uint32_t factor);
+uint32_t filter_get_decimation(void);
+
+int filter_set_channel(size_t idx, uint8_t flags);
+uint8_t filter_get_channel(size_t idx);
+
+/* Feeds one scan, called from the sampler thread. Returns true and
+ * fills out once a decimation window is complete. The output sequence
+ * number counts windows, its timestamp is the middle of the window.
+ */
+bool filter_process(const struct sampler_scan *in, struct sampler_scan *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FILTER_H_ */
@@ -0,0 +1,247 @@
+/** @file
+ *  @brief Connection PHY and parameter management
+ *
+ *  Asks for LE 2M PHY on every connection and switches between a short
+ *  interval while streaming and a long interval with peripheral latency
+ *  while idle, following the sample rate.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sampler.h"
+#include "filter.h"
+#include "link.h"
+
+LOG_MODULE_REGISTER(link, CONFIG_APP_LOG_LEVEL);
+
+/* 7.5 ms to 15 ms, no latency, 4 s supervision timeout */
+static const struct bt_le_conn_param streaming_param =
+	BT_LE_CONN_PARAM_INIT(6, 12, 0, 400);
+
+/* 100 ms to 200 ms, 4 events latency, 6 s supervision timeout */
+static const struct bt_le_conn_param idle_param =
+	BT_LE_CONN_PARAM_INIT(80, 160, 4, 600);
+
+static const char * const profile_name[] = {
+	[LINK_PROFILE_IDLE] = "idle",
+	[LINK_PROFILE_STREAMING] = "streaming",
+};
+
+static K_MUTEX_DEFINE(link_lock);
+static struct bt_conn *link_conn;
+static struct link_status status;
+/* Profile last requested from the central */
+static enum link_profile requested;
+
+static struct bt_uuid_128 link_svc_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400010, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 link_status_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400011, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static ssize_t read_status(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   void *buf, uint16_t len, uint16_t offset)
+{
+	struct link_status value;
+
+	link_get_status(&value);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &value,
+				 sizeof(value));
+}
+
+/* Link Status Service Declaration */
+BT_GATT_SERVICE_DEFINE(link_svc,
+	BT_GATT_PRIMARY_SERVICE(&link_svc_uuid),
+	BT_GATT_CHARACTERISTIC(&link_status_uuid.uuid,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_READ, read_status, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+/* Called with link_lock held */
+static void notify_status(void)
+{
+	struct bt_gatt_notify_params params = {
+		.attr = &link_svc.attrs[1],
+		.data = &status,
+		.len = sizeof(status),
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_CONTROL),
+#endif
+	};
+
+	if (!link_conn) {
+		return;
+	}
+
+	(void)bt_gatt_notify_cb(link_conn, &params);
+}
+
+static enum link_profile wanted_profile(void)
+{
+	/* What goes on air is the decimated rate */
+	if (sampler_is_running() &&
+	    sampler_get_rate() / filter_get_decimation() >=
+	    CONFIG_APP_LINK_STREAMING_MIN_RATE_HZ) {
+		return LINK_PROFILE_STREAMING;
+	}
+
+	return LINK_PROFILE_IDLE;
+}
+
+/* Called with link_lock held */
+static void request_profile(enum link_profile profile)
+{
+	const struct bt_le_conn_param *param;
+	int err;
+
+	param = (profile == LINK_PROFILE_STREAMING) ? &streaming_param :
+						      &idle_param;
+
+	err = bt_conn_le_param_update(link_conn, param);
+	if (err && err != -EALREADY) {
+		LOG_ERR("Connection profile %s failed (err %d)",
+			profile_name[profile], err);
+		return;
+	}
+
+	LOG_INF("Requested %s connection profile", profile_name[profile]);
+	requested = profile;
+}
+
+void link_update_profile(void)
+{
+	enum link_profile profile = wanted_profile();
+
+	k_mutex_lock(&link_lock, K_FOREVER);
+
+	if (link_conn && profile != requested) {
+		request_profile(profile);
+	}
+
+	k_mutex_unlock(&link_lock);
+}
+
+void link_get_status(struct link_status *out)
+{
+	k_mutex_lock(&link_lock, K_FOREVER);
+	*out = status;
+	k_mutex_unlock(&link_lock);
+}
+
+enum bt_att_chan_opt link_bearer(enum link_traffic traffic)
+{
+	enum bt_att_chan_opt opt = BT_ATT_CHAN_OPT_NONE;
+
+#if defined(CONFIG_BT_EATT)
+	if (traffic == LINK_TRAFFIC_CONTROL) {
+		return BT_ATT_CHAN_OPT_UNENHANCED_ONLY;
+	}
+
+	/* A client without EATT only has the unenhanced bearer */
+	k_mutex_lock(&link_lock, K_FOREVER);
+	if (link_conn && bt_eatt_count(link_conn) > 0U) {
+		opt = BT_ATT_CHAN_OPT_ENHANCED_ONLY;
+	}
+	k_mutex_unlock(&link_lock);
+#endif
+
+	return opt;
+}
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	struct bt_conn_info info;
+	int ret;
+
+	if (err) {
+		return;
+	}
+
+	k_mutex_lock(&link_lock, K_FOREVER);
+
+	link_conn = bt_conn_ref(conn);
+
+	if (bt_conn_get_info(conn, &info) == 0) {
+		status.interval = info.le.interval;
+		status.latency = info.le.latency;
+		status.timeout = info.le.timeout;
+		status.tx_phy = info.le.phy->tx_phy;
+		status.rx_phy = info.le.phy->rx_phy;
+	}
+
+	/* 2M PHY roughly halves the airtime of every PDU */
+	ret = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (ret) {
+		LOG_ERR("PHY update request failed (err %d)", ret);
+	}
+
+	request_profile(wanted_profile());
+	status.profile = requested;
+
+	k_mutex_unlock(&link_lock);
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	k_mutex_lock(&link_lock, K_FOREVER);
+
+	if (link_conn == conn) {
+		bt_conn_unref(link_conn);
+		link_conn = NULL;
+	}
+
+	k_mutex_unlock(&link_lock);
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval,
+			     uint16_t latency, uint16_t timeout)
+{
+	LOG_INF("Connection parameters: interval %u us, latency %u, "
+		"timeout %u ms", interval * 1250U, latency, timeout * 10U);
+
+	k_mutex_lock(&link_lock, K_FOREVER);
+
+	status.interval = interval;
+	status.latency = latency;
+	status.timeout = timeout;
+	status.profile = requested;
+	notify_status();
+
+	k_mutex_unlock(&link_lock);
+}
+
+static void le_phy_updated(struct bt_conn *conn,
+			   struct bt_conn_le_phy_info *param)
+{
+	LOG_INF("PHY updated: TX %u, RX %u", param->tx_phy, param->rx_phy);
+
+	k_mutex_lock(&link_lock, K_FOREVER);
+
+	status.tx_phy = param->tx_phy;
+	status.rx_phy = param->rx_phy;
+	notify_status();
+
+	k_mutex_unlock(&link_lock);
+}
+
+BT_CONN_CB_DEFINE(link_conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+};
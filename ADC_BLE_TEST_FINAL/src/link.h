@@ -0,0 +1,63 @@
+/** @file
+ *  @brief Connection PHY and parameter management
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <zephyr/types.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/bluetooth/att.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum link_profile {
+	/* Long interval with peripheral latency, radio mostly off */
+	LINK_PROFILE_IDLE,
+	/* Shortest interval, for continuous sample streaming */
+	LINK_PROFILE_STREAMING,
+};
+
+enum link_traffic {
+	/* Sample frames and log chunks, sent back to back */
+	LINK_TRAFFIC_DATA,
+	/* Command responses and status updates */
+	LINK_TRAFFIC_CONTROL,
+};
+
+/* Values negotiated on the current connection, as read over GATT */
+struct link_status {
+	uint8_t profile;
+	uint8_t tx_phy;
+	uint8_t rx_phy;
+	/* Connection interval in units of 1.25 ms */
+	uint16_t interval;
+	uint16_t latency;
+	/* Supervision timeout in units of 10 ms */
+	uint16_t timeout;
+} __packed;
+
+/* Re-evaluates the connection profile against the current sample rate.
+ * Call after the sample rate or the sampling state changed.
+ */
+void link_update_profile(void);
+
+void link_get_status(struct link_status *status);
+
+/* ATT bearers a notification or indication of the given traffic may use.
+ * With enhanced bearers open, data goes over those and control keeps the
+ * unenhanced bearer, so it never queues behind data.
+ */
+enum bt_att_chan_opt link_bearer(enum link_traffic traffic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LINK_H_ */
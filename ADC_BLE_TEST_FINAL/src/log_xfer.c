@@ -0,0 +1,361 @@
+/** @file
+ *  @brief Bulk download of the sample log
+ *
+ *  Commands are queued by the GATT write callback and run in a thread
+ *  of their own, below the sender, so a download only takes what the
+ *  live stream leaves of the link. A read keeps as many chunks in
+ *  flight as the TX credits allow; any command written meanwhile ends
+ *  it before it runs.
+ *
+ *  While a client is subscribed to the data characteristic the replay
+ *  of the log on the sample stream is held, the client is expected to
+ *  download the log and release what it stored instead.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sample_log.h"
+#include "link.h"
+#include "log_xfer.h"
+
+LOG_MODULE_REGISTER(log_xfer, CONFIG_APP_LOG_LEVEL);
+
+#define ATT_NOTIFY_HDR_LEN 3U
+#define CHUNK_MAX_LEN (CONFIG_BT_L2CAP_TX_MTU - ATT_NOTIFY_HDR_LEN)
+#define CMD_MAX_LEN 9U
+#define RSP_MAX_LEN 6U
+
+#define TX_CREDITS (CONFIG_APP_LOG_XFER_TX_CREDITS ?			\
+		    CONFIG_APP_LOG_XFER_TX_CREDITS :			\
+		    CONFIG_BT_BUF_ACL_TX_COUNT - 1)
+
+BUILD_ASSERT(CHUNK_MAX_LEN > LOG_XFER_CHUNK_HDR_LEN);
+BUILD_ASSERT(TX_CREDITS > 0);
+
+struct xfer_cmd {
+	struct bt_conn *conn;
+	uint8_t len;
+	uint8_t data[CMD_MAX_LEN];
+};
+
+K_MSGQ_DEFINE(xfer_q, sizeof(struct xfer_cmd), 4, 4);
+
+static K_SEM_DEFINE(tx_credits, TX_CREDITS, TX_CREDITS);
+
+static uint8_t chunk[CHUNK_MAX_LEN];
+
+static struct bt_uuid_128 xfer_svc_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400040, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 xfer_info_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400041, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 xfer_cp_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400042, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 xfer_data_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400043, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static ssize_t read_info(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			 void *buf, uint16_t len, uint16_t offset)
+{
+	struct sample_log_stats stats;
+	uint32_t start;
+	uint32_t end;
+	uint8_t value[16];
+
+	sample_log_range(&start, &end);
+	sample_log_get_stats(&stats);
+
+	sys_put_le32(start, &value[0]);
+	sys_put_le32(end, &value[4]);
+	sys_put_le32(stats.pending, &value[8]);
+	sys_put_le32(sample_log_boot_id(), &value[12]);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, value,
+				 sizeof(value));
+}
+
+static ssize_t write_cp(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			const void *buf, uint16_t len, uint16_t offset,
+			uint8_t flags)
+{
+	struct xfer_cmd cmd;
+
+	if (offset != 0U) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	if (len == 0U || len > sizeof(cmd.data)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	cmd.conn = bt_conn_ref(conn);
+	cmd.len = len;
+	memcpy(cmd.data, buf, len);
+
+	if (k_msgq_put(&xfer_q, &cmd, K_NO_WAIT) != 0) {
+		bt_conn_unref(cmd.conn);
+		return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+	}
+
+	return len;
+}
+
+static void data_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
+{
+	sample_log_hold(value == BT_GATT_CCC_NOTIFY);
+}
+
+/* Log Transfer Service Declaration */
+BT_GATT_SERVICE_DEFINE(xfer_svc,
+	BT_GATT_PRIMARY_SERVICE(&xfer_svc_uuid),
+	BT_GATT_CHARACTERISTIC(&xfer_info_uuid.uuid, BT_GATT_CHRC_READ,
+			       BT_GATT_PERM_READ_ENCRYPT,
+			       read_info, NULL, NULL),
+	BT_GATT_CHARACTERISTIC(&xfer_cp_uuid.uuid,
+			       BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_WRITE_ENCRYPT,
+			       NULL, write_cp, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_CHARACTERISTIC(&xfer_data_uuid.uuid, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(data_ccc_changed,
+		    BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_ENCRYPT),
+);
+
+#define CP_ATTR (&xfer_svc.attrs[4])
+#define DATA_ATTR (&xfer_svc.attrs[7])
+
+static void respond(struct bt_conn *conn, uint8_t op, uint8_t status,
+		    const uint8_t *results, uint8_t len)
+{
+	uint8_t rsp[RSP_MAX_LEN];
+	struct bt_gatt_notify_params params = {
+		.attr = CP_ATTR,
+		.data = rsp,
+		.len = 2U + len,
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_CONTROL),
+#endif
+	};
+	int err;
+
+	rsp[0] = op | LOG_XFER_RESPONSE;
+	rsp[1] = status;
+	memcpy(&rsp[2], results, len);
+
+	err = bt_gatt_notify_cb(conn, &params);
+	if (err) {
+		LOG_WRN("Response to 0x%02x not sent (err %d)", op, err);
+	}
+}
+
+/* Runs in the BT TX context once the chunk reached the controller */
+static void chunk_done(struct bt_conn *conn, void *user_data)
+{
+	k_sem_give(&tx_credits);
+}
+
+static int send_chunk(struct bt_conn *conn, uint16_t len)
+{
+	struct bt_gatt_notify_params params = {
+		.attr = DATA_ATTR,
+		.data = chunk,
+		.len = len,
+		.func = chunk_done,
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_DATA),
+#endif
+	};
+	int err;
+
+	k_sem_take(&tx_credits, K_FOREVER);
+
+	/* Buffers are shared with the sample stream, which goes first */
+	while ((err = bt_gatt_notify_cb(conn, &params)) == -ENOMEM) {
+		k_sleep(K_MSEC(1));
+	}
+
+	if (err) {
+		k_sem_give(&tx_credits);
+	}
+
+	return err;
+}
+
+/* Streams the log from off until length bytes or the end of the log are
+ * sent, or another command arrives
+ */
+static void transfer(struct bt_conn *conn, uint32_t off, uint32_t length)
+{
+	uint32_t left = length ? length : UINT32_MAX;
+	uint32_t sent = 0U;
+	int64_t start = k_uptime_get();
+
+	while (1) {
+		uint16_t size = MIN(bt_gatt_get_mtu(conn) - ATT_NOTIFY_HDR_LEN,
+				    sizeof(chunk)) - LOG_XFER_CHUNK_HDR_LEN;
+		int n = 0;
+		int err;
+
+		if (k_msgq_num_used_get(&xfer_q) != 0U) {
+			LOG_INF("Read ended by a new command at %u", off);
+			return;
+		}
+
+		if (left != 0U) {
+			n = sample_log_read(off,
+					    &chunk[LOG_XFER_CHUNK_HDR_LEN],
+					    MIN(size, left));
+		}
+
+		if (n < 0) {
+			/* Ends the read without the end chunk, the client
+			 * times out and reads again from off
+			 */
+			LOG_WRN("Log read at %u failed (err %d)", off, n);
+			return;
+		}
+
+		sys_put_le32(off, &chunk[0]);
+		sys_put_le32(crc32_ieee(&chunk[LOG_XFER_CHUNK_HDR_LEN], n),
+			     &chunk[4]);
+
+		err = send_chunk(conn, LOG_XFER_CHUNK_HDR_LEN + n);
+		if (err) {
+			LOG_WRN("Read ended at %u (err %d)", off, err);
+			return;
+		}
+
+		if (n == 0) {
+			break;
+		}
+
+		off += n;
+		left -= n;
+		sent += n;
+	}
+
+	LOG_INF("Log read: %u bytes in %lld ms", sent,
+		k_uptime_get() - start);
+}
+
+static void run(const struct xfer_cmd *cmd)
+{
+	uint8_t op = cmd->data[0];
+	uint8_t param_len = cmd->len - 1U;
+	const uint8_t *param = &cmd->data[1];
+	uint8_t results[4];
+	uint8_t status = LOG_XFER_STATUS_OK;
+	uint8_t results_len = 0U;
+	uint32_t start;
+	uint32_t end;
+	uint32_t off;
+	int n;
+
+	switch (op) {
+	case LOG_XFER_OP_READ:
+		if (param_len != 8U) {
+			status = LOG_XFER_STATUS_INVALID_LENGTH;
+			break;
+		}
+
+		off = sys_get_le32(param);
+		sample_log_range(&start, &end);
+
+		if (!bt_gatt_is_subscribed(cmd->conn, DATA_ATTR,
+					   BT_GATT_CCC_NOTIFY)) {
+			status = LOG_XFER_STATUS_NOT_SUBSCRIBED;
+		} else if ((int32_t)(off - start) < 0) {
+			status = LOG_XFER_STATUS_OFFSET_GONE;
+		} else if ((int32_t)(end - off) < 0) {
+			status = LOG_XFER_STATUS_INVALID_PARAM;
+		}
+
+		respond(cmd->conn, op, status, results, 0U);
+
+		if (status == LOG_XFER_STATUS_OK) {
+			transfer(cmd->conn, off, sys_get_le32(&param[4]));
+		}
+		return;
+
+	case LOG_XFER_OP_ABORT:
+		/* A read in progress has already ended */
+		if (param_len != 0U) {
+			status = LOG_XFER_STATUS_INVALID_LENGTH;
+		}
+		break;
+
+	case LOG_XFER_OP_RELEASE:
+		if (param_len != 4U) {
+			status = LOG_XFER_STATUS_INVALID_LENGTH;
+			break;
+		}
+
+		n = sample_log_release(sys_get_le32(param));
+		if (n < 0) {
+			status = LOG_XFER_STATUS_FAILED;
+			break;
+		}
+
+		sys_put_le32(n, results);
+		results_len = 4U;
+		break;
+
+	default:
+		status = LOG_XFER_STATUS_UNKNOWN_OPCODE;
+		break;
+	}
+
+	respond(cmd->conn, op, status, results, results_len);
+}
+
+static void xfer_thread(void *p1, void *p2, void *p3)
+{
+	struct xfer_cmd cmd;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		k_msgq_get(&xfer_q, &cmd, K_FOREVER);
+		run(&cmd);
+		bt_conn_unref(cmd.conn);
+	}
+}
+
+K_THREAD_DEFINE(xfer_tid, CONFIG_APP_LOG_XFER_STACK_SIZE, xfer_thread,
+		NULL, NULL, NULL, CONFIG_APP_LOG_XFER_PRIORITY, 0, 0);
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	/* Completions of chunks still queued at disconnect may never
+	 * arrive. The semaphore limit keeps late ones from adding credits.
+	 */
+	for (int i = 0; i < TX_CREDITS; i++) {
+		k_sem_give(&tx_credits);
+	}
+}
+
+BT_CONN_CB_DEFINE(xfer_conn_callbacks) = {
+	.disconnected = disconnected,
+};
@@ -0,0 +1,63 @@
+/** @file
+ *  @brief Bulk download of the sample log
+ *
+ *  A transfer service after the Bluetooth Object Transfer Service. The
+ *  log is one object, the byte stream of sample_log_read(), addressed
+ *  by the stream offsets of the sample log. All fields little endian:
+ *
+ *    object info    read    u32 first offset, u32 end offset,
+ *                           u32 frames, u32 boot ID
+ *    control point  write   opcode, parameters
+ *                   notify  opcode | LOG_XFER_RESPONSE, status, results
+ *    data           notify  u32 offset, u32 CRC-32 of the data, data
+ *
+ *  A read streams the object from its offset in chunks as large as the
+ *  MTU allows and ends with a chunk without data at the offset reached.
+ *  An interrupted download resumes with a read from the offset after
+ *  the last chunk that passed its CRC, if the boot ID is still the
+ *  same. Offsets restart from 0 on every boot, and a boot ID of 0 means
+ *  the device could not count its boots.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LOG_XFER_H_
+#define LOG_XFER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_XFER_RESPONSE 0x80U
+#define LOG_XFER_CHUNK_HDR_LEN 8U
+
+enum log_xfer_opcode {
+	/* u32 offset, u32 length or 0 for the rest of the log */
+	LOG_XFER_OP_READ = 0x01,
+	/* No parameters, ends the read in progress */
+	LOG_XFER_OP_ABORT = 0x02,
+	/* u32 offset, releases the frames ending at or before it and
+	 * returns their u32 count
+	 */
+	LOG_XFER_OP_RELEASE = 0x03,
+};
+
+enum log_xfer_status {
+	LOG_XFER_STATUS_OK = 0x00,
+	LOG_XFER_STATUS_UNKNOWN_OPCODE = 0x01,
+	LOG_XFER_STATUS_INVALID_LENGTH = 0x02,
+	LOG_XFER_STATUS_INVALID_PARAM = 0x03,
+	/* The offset was released or overwritten */
+	LOG_XFER_STATUS_OFFSET_GONE = 0x04,
+	/* Reads need notifications of the data characteristic enabled */
+	LOG_XFER_STATUS_NOT_SUBSCRIBED = 0x05,
+	LOG_XFER_STATUS_FAILED = 0x06,
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_XFER_H_ */
@@ -10,7 +10,7 @@
 #include <stddef.h>
 #include <string.h>
 #include <errno.h>
-#include <zephyr/sys/printk.h>
+#include <zephyr/logging/log.h>
 #include <zephyr/sys/byteorder.h>
 #include <zephyr/kernel.h>
 
@@ -28,29 +28,24 @@
 /* Including additional packages from ADC codes */
 #include <inttypes.h>
 #include <stdint.h>
-#include <zephyr/device.h>
-#include <zephyr/devicetree.h>
-#include <zephyr/drivers/adc.h>
 #include <zephyr/sys/util.h>
 
 
 #include "cts.h"
-
-/* ADC Initialization Codes */
-#if !DT_NODE_EXISTS(DT_PATH(zephyr_user)) || \
-	!DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
-#error "No suitable devicetree overlay specified"
-#endif
-
-#define DT_SPEC_AND_COMMA(node_id, prop, idx) \
-	ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
-
-/* Data of ADC io-channels specified in devicetree. */
-static const struct adc_dt_spec adc_channels[] = {
-	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels,
-			     DT_SPEC_AND_COMMA)
-};
-/* END of ADC Initialization Codes */
+#include "sampler.h"
+#include "filter.h"
+#include "sample_ring.h"
+#include "stream.h"
+#include "sample_log.h"
+#include "control.h"
+#include "digipot.h"
+#include "adc_waveform.h"
+#include "regulator.h"
+#include "coc.h"
+#include "broadcast.h"
+#include "summary.h"
+
+LOG_MODULE_REGISTER(main, CONFIG_APP_LOG_LEVEL);
 
 /* Change the given UUID to the provided board */
 /* Custom Service Variables */
@@ -89,7 +84,6 @@ static struct bt_uuid_128 vnd_auth_uuid = BT_UUID_INIT_128(
 // static uint8_t vnd_value[VND_MAX_LEN + 1] = { 'V', 'e', 'n', 'd', 'o', 'r'};
 static uint8_t vnd_value[VND_MAX_LEN + 1] = {"0000 0000 0000 0001"};
 static uint8_t vnd_auth_value[VND_MAX_LEN + 1] = {"0000 0000 0000 0002"};
-static uint8_t vnd_wwr_value[VND_MAX_LEN + 1] = {"0000 0000 0000 0003"};
 
 /* The handler of the reading, the buffer contains the data to write, and len contains the length of the data */
 static ssize_t read_vnd(struct bt_conn *conn, const struct bt_gatt_attr *attr,
@@ -119,25 +113,16 @@ static ssize_t write_vnd(struct bt_conn *conn, const struct bt_gatt_attr *attr,
 	return len;
 }
 
-static uint8_t simulate_vnd;
-static uint8_t indicating;
-static struct bt_gatt_indicate_params ind_params;
-
 static void vnd_ccc_cfg_changed(const struct bt_gatt_attr *attr, uint16_t value)
 {
-	simulate_vnd = (value == BT_GATT_CCC_INDICATE) ? 1 : 0;
-}
-
-static void indicate_cb(struct bt_conn *conn,
-			struct bt_gatt_indicate_params *params, uint8_t err)
-{
-	printk("Indication %s\n", err != 0U ? "fail" : "success");
-}
-
-static void indicate_destroy(struct bt_gatt_indicate_params *params)
-{
-	printk("Indication complete\n");
-	indicating = 0U;
+	/* Subscribing to indications selects the reliable delivery mode */
+	if (value == BT_GATT_CCC_INDICATE) {
+		stream_set_mode(STREAM_MODE_INDICATE);
+	} else if (value == BT_GATT_CCC_NOTIFY) {
+		stream_set_mode(STREAM_MODE_NOTIFY);
+	} else {
+		stream_set_mode(STREAM_MODE_OFF);
+	}
 }
 
 #define VND_LONG_MAX_LEN 74
@@ -209,13 +194,12 @@ static const struct bt_uuid_128 vnd_signed_uuid = BT_UUID_INIT_128(
 static const struct bt_uuid_128 vnd_write_cmd_uuid = BT_UUID_INIT_128(
 	BT_UUID_128_ENCODE(0x12345678, 0x1234, 0x5678, 0x1234, 0x56789abcdef4));
 
+/* Control commands, see control.h. Responses are notified back */
 static ssize_t write_without_rsp_vnd(struct bt_conn *conn,
 				     const struct bt_gatt_attr *attr,
 				     const void *buf, uint16_t len, uint16_t offset,
 				     uint8_t flags)
 {
-	uint8_t *value = attr->user_data;
-
 	if (!(flags & BT_GATT_WRITE_FLAG_CMD)) {
 		/* Write Request received. Reject it since this Characteristic
 		 * only accepts Write Without Response.
@@ -223,12 +207,14 @@ static ssize_t write_without_rsp_vnd(struct bt_conn *conn,
 		return BT_GATT_ERR(BT_ATT_ERR_WRITE_REQ_REJECTED);
 	}
 
-	if (offset + len > VND_MAX_LEN) {
+	if (offset != 0U) {
 		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
 	}
 
-	memcpy(value + offset, buf, len);
-	value[offset + len] = 0;
+	/* There is no error response to a command, a dropped one is
+	 * noticed by the missing acknowledgment
+	 */
+	(void)control_receive(buf, len);
 
 	return len;
 }
@@ -272,23 +258,60 @@ BT_GATT_SERVICE_DEFINE(vnd_svc,
 			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE,
 			       read_signed, write_signed, &signed_value),
 	BT_GATT_CHARACTERISTIC(&vnd_write_cmd_uuid.uuid,
-			       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
-			       BT_GATT_PERM_WRITE, NULL,
-			       write_without_rsp_vnd, &vnd_wwr_value),
+			       BT_GATT_CHRC_WRITE_WITHOUT_RESP |
+			       BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_WRITE_ENCRYPT, NULL,
+			       write_without_rsp_vnd, NULL),
+	/* Commands drive the current source, only a paired client may
+	 * send them or subscribe to their responses
+	 */
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_ENCRYPT),
 );
 
+/* Rewritten every CONFIG_APP_SUMMARY_INTERVAL_MS, see summary.h */
+static uint8_t summary[SUMMARY_LEN];
+
+/* Flags and the summary, each with its length and type */
+BUILD_ASSERT(3U + 2U + SUMMARY_LEN <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+	     "Too many channels for the advertised summary");
+
+/* The summary goes in the advertising data so passive scanners see it,
+ * the service UUID moves to the scan response. The HRS, BAS and CTS
+ * UUIDs are left out, they no longer fit and remain discoverable.
+ */
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
-	BT_DATA_BYTES(BT_DATA_UUID16_ALL,
-		      BT_UUID_16_ENCODE(BT_UUID_HRS_VAL),
-		      BT_UUID_16_ENCODE(BT_UUID_BAS_VAL),
-		      BT_UUID_16_ENCODE(BT_UUID_CTS_VAL)),
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, summary, sizeof(summary)),
+};
+
+static const struct bt_data sd[] = {
 	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_CUSTOM_SERVICE_VAL),
 };
 
+static void summary_handler(struct k_work *work)
+{
+	int err;
+
+	summary_encode(summary);
+
+	/* Nothing is advertised while the central is connected */
+	err = bt_le_adv_update_data(ad, ARRAY_SIZE(ad), sd, ARRAY_SIZE(sd));
+	if (err && err != -EAGAIN) {
+		LOG_WRN("Advertising data update failed (err %d)", err);
+	}
+
+	k_work_schedule(k_work_delayable_from_work(work),
+			K_MSEC(CONFIG_APP_SUMMARY_INTERVAL_MS));
+}
+
+static K_WORK_DELAYABLE_DEFINE(summary_work, summary_handler);
+
 void mtu_updated(struct bt_conn *conn, uint16_t tx, uint16_t rx)
 {
-	printk("Updated MTU: TX: %d RX: %d bytes\n", tx, rx);
+	LOG_INF("Updated MTU: TX: %d RX: %d bytes", tx, rx);
+
+	/* Batch as many samples as fit in one notification */
+	stream_set_mtu(tx);
 }
 
 /* Registers a set of callback handlers for different GATT events */
@@ -298,38 +321,104 @@ static struct bt_gatt_cb gatt_callbacks = {
 
 };
 
+#if defined(CONFIG_BT_GATT_CLIENT)
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	if (err) {
+		LOG_ERR("MTU exchange failed (err %u)", err);
+	}
+}
+
+static struct bt_gatt_exchange_params mtu_exchange_params = {
+	.func = mtu_exchanged,
+};
+#endif /* CONFIG_BT_GATT_CLIENT */
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn,
+				struct bt_conn_le_data_len_info *info)
+{
+	LOG_INF("Data length: TX %u bytes/%u us, RX %u bytes/%u us",
+		info->tx_max_len, info->tx_max_time,
+		info->rx_max_len, info->rx_max_time);
+}
+#endif /* CONFIG_BT_USER_DATA_LEN_UPDATE */
+
+/* Asks for the largest MTU and LL payload the build supports, so a
+ * notification is neither capped at 20 bytes nor split into 27-byte PDUs.
+ * Only the streaming profile (overlay-streaming.conf) enables these.
+ */
+static void request_link_upgrade(struct bt_conn *conn)
+{
+	int err;
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (err) {
+		LOG_ERR("Data length update failed (err %d)", err);
+	}
+#endif
+
+#if defined(CONFIG_BT_GATT_CLIENT)
+	err = bt_gatt_exchange_mtu(conn, &mtu_exchange_params);
+	if (err) {
+		LOG_ERR("MTU exchange failed (err %d)", err);
+	}
+#endif
+
+	ARG_UNUSED(err);
+}
+
 static void connected(struct bt_conn *conn, uint8_t err)
 {
 	if (err) {
-		printk("Connection failed (err 0x%02x)\n", err);
+		LOG_ERR("Connection failed (err 0x%02x)", err);
 	} else {
-		printk("Connected\n");
+		LOG_INF("Connected");
+
+		request_link_upgrade(conn);
 	}
 }
 
 static void disconnected(struct bt_conn *conn, uint8_t reason)
 {
-	printk("Disconnected (reason 0x%02x)\n", reason);
+	LOG_INF("Disconnected (reason 0x%02x)", reason);
+
+	stream_disconnected();
+}
+
+/* Scanning monitors see an alert level in the next advertisement */
+static void alert_changed(bool alert)
+{
+	summary_set_alert(alert);
+	k_work_reschedule(&summary_work, K_NO_WAIT);
 }
 
 static void alert_stop(void)
 {
-	printk("Alert stopped\n");
+	LOG_INF("Alert stopped");
+	alert_changed(false);
 }
 
 static void alert_start(void)
 {
-	printk("Mild alert started\n");
+	LOG_INF("Mild alert started");
+	alert_changed(true);
 }
 
 static void alert_high_start(void)
 {
-	printk("High alert started\n");
+	LOG_INF("High alert started");
+	alert_changed(true);
 }
 
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	.le_data_len_updated = le_data_len_updated,
+#endif
 };
 
 BT_IAS_CB_DEFINE(ias_callbacks) = {
@@ -349,20 +438,25 @@ static void bt_ready(void)
 	}
 
 	/* Starts connectable BLE advertising using the given advertising data buffer. The advertising data would typically contain something like the device name */
-	/* In this general example, no scan response data is provided */
+	/* The scan response holds the service UUID and the name, shortened to what fits */
 	/* Allow for further customization: 
 		- Choosing advertising type 
 		- Setting advertising and scan response data 
 		- Configuring advertising intervals/duration
 		- Restarting advertising as needed 
 		- Registering an advertising stop callback */
-	err = bt_le_adv_start(BT_LE_ADV_CONN_NAME, ad, ARRAY_SIZE(ad), NULL, 0);
+	summary_encode(summary);
+
+	err = bt_le_adv_start(BT_LE_ADV_CONN_NAME, ad, ARRAY_SIZE(ad),
+			      sd, ARRAY_SIZE(sd));
 	if (err) {
-		printk("Advertising failed to start (err %d)\n", err);
+		LOG_ERR("Advertising failed to start (err %d)", err);
 		return;
 	}
 
-	printk("Advertising successfully started\n");
+	LOG_INF("Advertising successfully started");
+
+	k_work_schedule(&summary_work, K_MSEC(CONFIG_APP_SUMMARY_INTERVAL_MS));
 }
 
 static void auth_passkey_display(struct bt_conn *conn, unsigned int passkey)
@@ -371,7 +465,7 @@ static void auth_passkey_display(struct bt_conn *conn, unsigned int passkey)
 
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
-	printk("Passkey for %s: %06u\n", addr, passkey);
+	LOG_INF("Passkey for %s: %06u", addr, passkey);
 }
 
 static void auth_cancel(struct bt_conn *conn)
@@ -381,7 +475,7 @@ static void auth_cancel(struct bt_conn *conn)
 	/* Gets the address of the remote device in the connection as a string */
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
-	printk("Pairing cancelled: %s\n", addr);
+	LOG_WRN("Pairing cancelled: %s", addr);
 }
 
 /* Registers callback handlers for authentication events like pairing */
@@ -422,48 +516,88 @@ static void hrs_notify(void)
 	bt_hrs_notify(heartrate);
 }
 
+/* Runs in the sampler thread once per completed scan */
+static void scan_ready(const struct sampler_scan *scan)
+{
+	struct sampler_scan filtered;
+	struct sampler_scan *slot;
+
+	/* Regulation works on the raw scans, ahead of any decimation */
+	if (IS_ENABLED(CONFIG_APP_REGULATOR)) {
+		regulator_feed(scan);
+	}
+
+	summary_feed(scan);
+
+	/* Only complete decimation windows are streamed */
+	if (!filter_process(scan, &filtered)) {
+		return;
+	}
+
+	/* A full ring is counted by the ring itself, the scan is dropped */
+	slot = sample_ring_put_claim();
+	if (!slot) {
+		return;
+	}
+
+	*slot = filtered;
+	sample_ring_put_commit();
+}
+
 int main(void)
 {
 	struct bt_gatt_attr *vnd_ind_attr;
+	struct sampler_stats stats;
+	struct sample_ring_stats ring_stats;
+	struct stream_stats stream_stats;
+	struct sample_log_stats log_stats;
+	struct broadcast_stats bcast_stats;
+	uint32_t last_bytes = 0U;
+	int64_t last_ms = 0;
+	int64_t now_ms;
 	char str[BT_UUID_STR_LEN];
 	int err;
 
-	uint32_t count = 0;
-	uint16_t buf;
-	struct adc_sequence sequence = {
-		.buffer = &buf,
-		/* buffer size in bytes, not number of samples */
-		.buffer_size = sizeof(buf),
-	};
-
-	/* Configure channels individually prior to sampling. */
-	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
-		if (!device_is_ready(adc_channels[i].dev)) {
-			printk("ADC controller device %s not ready\n", adc_channels[i].dev->name);
+	filter_init();
+
+	err = sampler_init(scan_ready);
+	if (err) {
+		LOG_ERR("Sampler init failed (err %d)", err);
+		return 0;
+	}
+
+	if (IS_ENABLED(CONFIG_ADC_EMUL)) {
+		err = adc_waveform_init();
+		if (err) {
+			LOG_ERR("ADC waveform init failed (err %d)", err);
 			return 0;
 		}
+	}
 
-		err = adc_channel_setup_dt(&adc_channels[i]);
-		if (err < 0) {
-			printk("Could not setup channel #%d (%d)\n", i, err);
-			return 0;
+	/* Without the log, samples taken while no client listens are lost */
+	if (IS_ENABLED(CONFIG_APP_SAMPLE_LOG)) {
+		err = sample_log_init();
+		if (err) {
+			LOG_ERR("Sample log init failed (err %d)", err);
 		}
 	}
 
-	/* Test integers to print */
-	int val1 = 1234;
-	int val2 = 5678;
-	int val3 = 9101;
-	int val4 = 1121;
+	/* The current source stays at its power-on wiper if this fails */
+	if (IS_ENABLED(CONFIG_APP_DIGIPOT)) {
+		err = digipot_init();
+		if (err) {
+			LOG_ERR("DigiPot init failed (err %d)", err);
+		}
+	}
 
 	/* Initializes the buetooth stack */
 	err = bt_enable(NULL);
 	if (err) {
-		printk("Bluetooth init failed (err %d)\n", err);
+		LOG_ERR("Bluetooth init failed (err %d)", err);
 		return 0;
 	}
 
-	printk("Bluetooth init successful (err %d)\n", err);
+	LOG_INF("Bluetooth init successful (err %d)", err);
 
 	/* Makes the app BLE-ready once Bluetooth is enabled */
 	bt_ready();
@@ -482,117 +616,86 @@ int main(void)
 
 	/* Converts the UUID to a string for printing */
 	bt_uuid_to_str(&vnd_enc_uuid.uuid, str, sizeof(str));
-	printk("Indicate VND attr %p (UUID %s)\n", vnd_ind_attr, str);
+	LOG_INF("Indicate VND attr %p (UUID %s)", vnd_ind_attr, str);
 
-	int32_t adc_final_reading[ARRAY_SIZE(adc_channels)];
+	/* The sender thread drains the sample ring from here on */
+	stream_init(vnd_ind_attr);
 
-	/* Implement notification. At the moment there is no suitable way
-	 * of starting delayed work so we do it here
-	 */
+	control_init(bt_gatt_find_by_uuid(vnd_svc.attrs, vnd_svc.attr_count,
+					  &vnd_write_cmd_uuid.uuid));
+
+	if (IS_ENABLED(CONFIG_APP_COC)) {
+		err = coc_init();
+		if (err) {
+			return 0;
+		}
+	}
+
+	/* Connected clients are still served if the train fails to start */
+	if (IS_ENABLED(CONFIG_APP_BROADCAST)) {
+		(void)broadcast_init();
+	}
+
+	/* Sampling is paced by the sampler's own timer from here on */
+	err = sampler_start(CONFIG_APP_SAMPLE_RATE_HZ);
+	if (err) {
+		LOG_ERR("Sampler start failed (err %d)", err);
+		return 0;
+	}
+
+	/* Periodically report the scan timing so jitter can be measured */
 	while (1) {
-		k_sleep(K_SECONDS(1));
-
-		/* Initializes four readings for four channels */
-		// int32_t adc_final_reading[4] = {0000, 0000, 0000, 0000};
-
-
-		// bt_gatt_cb_register(&gatt_callbacks);
-
-		// /* Current Time Service updates only when time is changed */
-		// cts_notify();
-
-		// /* Heartrate measurements simulation */
-		// hrs_notify();
-
-		// /* Battery level simulation */
-		// bas_notify();
-
-		/* Print to the serial monitor "Hello World" with the printing counts */
-		// printk("Hello World %d\n", k_cycle_get_32());
-
-		/* Print ADC measurements and data */
-		printk("ADC reading[%u]:\n", count++);
-		for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
-			int32_t val_mv;
-
-			printk("- %s, channel %d: ",
-			       adc_channels[i].dev->name,
-			       adc_channels[i].channel_id);
-
-			(void)adc_sequence_init_dt(&adc_channels[i], &sequence);
-
-			err = adc_read(adc_channels[i].dev, &sequence);
-			if (err < 0) {
-				printk("Could not read (%d)\n", err);
-				continue;
-			}
-
-			/*
-			 * If using differential mode, the 16 bit value
-			 * in the ADC sample buffer should be a signed 2's
-			 * complement value.
-			 */
-			if (adc_channels[i].channel_cfg.differential) {
-				val_mv = (int32_t)((int16_t)buf);
-			} else {
-				val_mv = (int32_t)buf;
-			}
-			printk("%"PRId32, val_mv);
-			err = adc_raw_to_millivolts_dt(&adc_channels[i],
-						       &val_mv);
-			/* conversion to mV may not be supported, skip if not */
-			if (err < 0) {
-				printk(" (value in mV not available)\n");
-			} else {
-				printk(" = %"PRId32" mV\n", val_mv);
-			}
-
-			/* Store the ADC result in each of the channel */
-			adc_final_reading[i] = val_mv;
-			
-			/* The printing statement works */
-			// printk("%04d", adc_final_reading[i]);
-			
-			/* Simply transmit the data during ADC reading? */
-			/* Gives an error */
-			// sprintf(vnd_value, val_mv);
-			
+		k_sleep(K_SECONDS(10));
+
+		sampler_get_stats(&stats);
+		LOG_INF("Sampler: %u scans, %u overruns, %u errors, "
+			"period %u..%u us, latency max %u us",
+			stats.scans, stats.overruns, stats.errors,
+			k_cyc_to_us_floor32(stats.period_min_cyc),
+			k_cyc_to_us_floor32(stats.period_max_cyc),
+			k_cyc_to_us_floor32(stats.latency_max_cyc));
+
+		sample_ring_get_stats(&ring_stats);
+		stream_get_stats(&stream_stats);
+		LOG_INF("Ring: %u puts, %u overflows, high water %u; "
+			"stream: %u scans, %u sent, %u tx errors, %u dropped, "
+			"%u stalls, %u in flight",
+			ring_stats.puts, ring_stats.overflows,
+			ring_stats.high_water, stream_stats.scans,
+			stream_stats.sent, stream_stats.tx_errors,
+			stream_stats.dropped, stream_stats.stalls,
+			stream_stats.in_flight);
+		if (stream_get_mode() == STREAM_MODE_INDICATE) {
+			LOG_INF("Indications: %u confirmed, %u retries, "
+				"%u pending", stream_stats.confirmed,
+				stream_stats.retries, stream_stats.pending);
+		}
+
+		if (IS_ENABLED(CONFIG_APP_SAMPLE_LOG)) {
+			sample_log_get_stats(&log_stats);
+			LOG_INF("Sample log: %u logged, %u replayed, "
+				"%u overwritten, %u pending", log_stats.logged,
+				log_stats.replayed, log_stats.overwritten,
+				log_stats.pending);
 		}
 
-		/* Test printing the entire array */
-		// printk("%04d %04d", adc_final_reading[0], adc_final_reading[1]);
-		// printk("%"PRId32"", adc_final_reading[0]);
-
-		/* Test for loop just for testing the dynamical assginment of the numbers */
-		// for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
-		// 	adc_final_reading[i] = i;
-		// }
-
-		/* Update the value of the characteristic */
-		// strcpy(vnd_value, "Values have been updated");
-		sprintf(vnd_value, "%04d %04d %04d %04d", adc_final_reading[0], adc_final_reading[1], adc_final_reading[2], adc_final_reading[3]);
-		// sprintf(vnd_value, "%04d %04d %04d %04d", val1, val2, val3, val4);
-		// sprintf(vnd_value, "%"PRId32" %"PRId32" %"PRId32" %"PRId32"", adc_final_reading[0], adc_final_reading[1], adc_final_reading[2], adc_final_reading[3]);
-		
-		/* Notify connected devices of the change */
-		bt_gatt_notify(NULL, &vnd_ind_attr->uuid, &vnd_value, strlen(vnd_value));
-
-		/* Vendor indication simulation */
-		if (simulate_vnd && vnd_ind_attr) {
-			if (indicating) {
-				continue;
-			}
-
-			ind_params.attr = vnd_ind_attr;
-			ind_params.func = indicate_cb;
-			ind_params.destroy = indicate_destroy;
-			ind_params.data = &indicating;
-			ind_params.len = sizeof(indicating);
-
-			if (bt_gatt_indicate(NULL, &ind_params) == 0) {
-				indicating = 1U;
-			}
+		if (IS_ENABLED(CONFIG_APP_BROADCAST)) {
+			broadcast_get_stats(&bcast_stats);
+			LOG_INF("Broadcast: %u aired, %u dropped, %u errors",
+				bcast_stats.aired, bcast_stats.dropped,
+				bcast_stats.errors);
 		}
+
+		/* Payload throughput since the previous report */
+		now_ms = k_uptime_get();
+		LOG_INF("Sender budget: %u cycles/scan avg, %u max",
+			stream_stats.cyc_avg, stream_stats.cyc_max);
+
+		LOG_INF("Throughput: %u B/s",
+			(uint32_t)((stream_stats.bytes - last_bytes) * 1000ULL /
+				   (now_ms - last_ms)));
+		last_bytes = stream_stats.bytes;
+		last_ms = now_ms;
 	}
 	return 0;
 }
@@ -0,0 +1,262 @@
+/** @file
+ *  @brief Closed-loop current regulation
+ *
+ *  A PI loop in Q8 fixed point around the open-loop wiper code of the
+ *  setpoint. The sense channel is averaged between updates and turned
+ *  into a current through the nominal sense resistor; the integral
+ *  term absorbs its tolerance. Integration pauses while the wiper is
+ *  saturated in the direction of the error, so the loop recovers from
+ *  an unreachable setpoint without windup.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sampler.h"
+#include "digipot.h"
+#include "regulator.h"
+
+LOG_MODULE_REGISTER(regulator, CONFIG_APP_LOG_LEVEL);
+
+BUILD_ASSERT(CONFIG_APP_REG_SENSE_CHANNEL < SAMPLER_NUM_CHANNELS);
+
+#define SENSE CONFIG_APP_REG_SENSE_CHANNEL
+#define Q8(x) ((int32_t)(x) * 256)
+#define OUT_MAX Q8(DIGIPOT_CODE_MAX)
+#define UPDATE_TICKS (CONFIG_SYS_CLOCK_TICKS_PER_SEC / CONFIG_APP_REG_RATE_HZ)
+
+static struct k_spinlock lock;
+static struct regulator_status status;
+
+/* Open-loop wiper code of the setpoint */
+static uint8_t feedforward;
+/* Integral term in Q8 wiper codes */
+static int32_t integral;
+static int64_t setpoint_ticks;
+static uint32_t in_band;
+
+/* Sense samples of the update in progress */
+static int64_t window_end;
+static int32_t window_sum;
+static uint32_t window_count;
+
+static struct bt_uuid_128 reg_svc_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400030, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static struct bt_uuid_128 reg_status_uuid = BT_UUID_INIT_128(
+	BT_UUID_128_ENCODE(0x6E400031, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E));
+
+static ssize_t read_status(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			   void *buf, uint16_t len, uint16_t offset)
+{
+	struct regulator_status value;
+
+	regulator_get_status(&value);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &value,
+				 sizeof(value));
+}
+
+/* Writing a u16 setpoint in uA starts the loop, 0 stops it */
+static ssize_t write_setpoint(struct bt_conn *conn,
+			      const struct bt_gatt_attr *attr, const void *buf,
+			      uint16_t len, uint16_t offset, uint8_t flags)
+{
+	if (offset != 0U) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_OFFSET);
+	}
+
+	if (len != sizeof(uint16_t)) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	if (regulator_set_setpoint(sys_get_le16(buf)) != 0) {
+		return BT_GATT_ERR(BT_ATT_ERR_VALUE_NOT_ALLOWED);
+	}
+
+	return len;
+}
+
+/* Current Regulation Service Declaration, only a paired client sets
+ * the output current
+ */
+BT_GATT_SERVICE_DEFINE(reg_svc,
+	BT_GATT_PRIMARY_SERVICE(&reg_svc_uuid),
+	BT_GATT_CHARACTERISTIC(&reg_status_uuid.uuid,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE,
+			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE_ENCRYPT,
+			       read_status, write_setpoint, NULL),
+);
+
+int regulator_set_setpoint(uint32_t ua)
+{
+	k_spinlock_key_t key;
+	uint8_t code = 0U;
+	int err;
+
+	if (ua > UINT16_MAX) {
+		return -ERANGE;
+	}
+
+	if (ua != 0U) {
+		uint8_t divisor[SAMPLER_NUM_CHANNELS];
+		uint8_t mask;
+
+		/* Without its sense channel the loop never updates */
+		sampler_get_channels(&mask, divisor);
+		if (!(mask & BIT(SENSE))) {
+			return -EINVAL;
+		}
+
+		err = digipot_ua_to_code(ua, &code);
+		if (err) {
+			return err;
+		}
+	}
+
+	key = k_spin_lock(&lock);
+	status.setpoint_ua = (uint16_t)ua;
+	status.settled = 0U;
+	status.settle_ms = 0U;
+	status.max_error_na = 0;
+	feedforward = code;
+	integral = 0;
+	in_band = 0U;
+	setpoint_ticks = k_uptime_ticks();
+	window_count = 0U;
+	k_spin_unlock(&lock, key);
+
+	LOG_INF("Setpoint %u uA, open-loop wiper %u", ua, code);
+
+	/* Start from the open-loop code instead of waiting an update */
+	return (ua != 0U) ? digipot_set_wiper(code) : 0;
+}
+
+/* Called with lock held, returns the new wiper code */
+static uint8_t pi_update(int32_t measured_na, int64_t now)
+{
+	int32_t error = (int32_t)status.setpoint_ua * 1000 - measured_na;
+	/* Gains are per uA, the error is in nA */
+	int32_t p = (int32_t)((int64_t)CONFIG_APP_REG_KP_Q8 * error / 1000);
+	int32_t i = integral +
+		    (int32_t)((int64_t)CONFIG_APP_REG_KI_Q8 * error / 1000);
+	int32_t out = Q8(feedforward) + p + i;
+
+	if (out > OUT_MAX) {
+		out = OUT_MAX;
+		status.saturations++;
+	} else if (out < 0) {
+		out = 0;
+		status.saturations++;
+	}
+
+	/* Conditional integration: only while it does not push further
+	 * into saturation
+	 */
+	if (!((out == OUT_MAX && error > 0) || (out == 0 && error < 0))) {
+		integral = CLAMP(i, -OUT_MAX, OUT_MAX);
+	}
+
+	status.measured_na = measured_na;
+	status.error_na = error;
+	status.updates++;
+
+	if (abs(error) <= CONFIG_APP_REG_TOLERANCE_NA) {
+		in_band++;
+	} else {
+		in_band = 0U;
+	}
+
+	if (!status.settled && in_band >= CONFIG_APP_REG_SETTLE_UPDATES) {
+		status.settled = 1U;
+		status.settle_ms = (uint32_t)k_ticks_to_ms_ceil64(now -
+								  setpoint_ticks);
+	} else if (status.settled) {
+		status.max_error_na = MAX(status.max_error_na, abs(error));
+	}
+
+	status.wiper = (uint8_t)((out + Q8(1) / 2) / Q8(1));
+
+	return status.wiper;
+}
+
+bool regulator_allows_channels(uint8_t mask)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	bool running = status.setpoint_ua != 0U;
+
+	k_spin_unlock(&lock, key);
+
+	return !running || (mask & BIT(SENSE));
+}
+
+void regulator_feed(const struct sampler_scan *scan)
+{
+	k_spinlock_key_t key;
+	int32_t mv;
+	bool update = false;
+	uint8_t code = 0U;
+
+	if (!(scan->mask & BIT(SENSE))) {
+		return;
+	}
+
+	key = k_spin_lock(&lock);
+
+	if (status.setpoint_ua == 0U) {
+		k_spin_unlock(&lock, key);
+		return;
+	}
+
+	if (window_count == 0U) {
+		window_end = scan->ticks + UPDATE_TICKS;
+		window_sum = 0;
+	}
+
+	window_sum += scan->raw[SENSE];
+	window_count++;
+
+	if (scan->ticks >= window_end) {
+		mv = window_sum / (int32_t)window_count;
+		window_count = 0U;
+
+		if (sampler_raw_to_mv(SENSE, &mv) == 0) {
+			/* mV across the sense resistor, in nA */
+			code = pi_update((int32_t)((int64_t)mv * 1000000 /
+						   digipot_rsense_ohms()),
+					 scan->ticks);
+			update = true;
+		}
+	}
+
+	k_spin_unlock(&lock, key);
+
+	/* Unchanged codes never reach the bus */
+	if (update) {
+		(void)digipot_set_wiper(code);
+	}
+}
+
+void regulator_get_status(struct regulator_status *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*out = status;
+
+	k_spin_unlock(&lock, key);
+}
@@ -0,0 +1,57 @@
+/** @file
+ *  @brief Closed-loop current regulation
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef REGULATOR_H_
+#define REGULATOR_H_
+
+#include <zephyr/types.h>
+#include <zephyr/toolchain.h>
+
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Loop state, as read over GATT */
+struct regulator_status {
+	/* 0 while the loop is idle */
+	uint16_t setpoint_ua;
+	/* Sense current averaged over the last update */
+	int32_t measured_na;
+	int32_t error_na;
+	/* Largest error magnitude since the loop settled */
+	int32_t max_error_na;
+	uint8_t wiper;
+	uint8_t settled;
+	/* Time from the last setpoint change until settled, 0 until then */
+	uint32_t settle_ms;
+	uint32_t updates;
+	/* Updates where the wiper hit either end of its range */
+	uint32_t saturations;
+} __packed;
+
+/* Starts regulating to ua, 0 stops the loop and leaves the wiper as is.
+ * Returns -ERANGE if the setpoint is beyond the DigiPot's reach, or
+ * -EINVAL while the sense channel is not sampled.
+ */
+int regulator_set_setpoint(uint32_t ua);
+
+/* False if mask leaves out the sense channel while the loop runs */
+bool regulator_allows_channels(uint8_t mask);
+
+/* Feeds every scan, called from the sampler thread */
+void regulator_feed(const struct sampler_scan *scan);
+
+void regulator_get_status(struct regulator_status *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REGULATOR_H_ */
@@ -0,0 +1,504 @@
+/** @file
+ *  @brief Binary sample frame format
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sample_frame.h"
+
+#define BIT_ONES(n) ((1U << (n)) - 1U)
+
+static uint8_t channel_count(uint8_t mask)
+{
+	uint8_t n = 0U;
+
+	for (; mask; mask &= mask - 1U) {
+		n++;
+	}
+
+	return n;
+}
+
+static void put_le16(uint8_t *dst, uint16_t val)
+{
+	dst[0] = (uint8_t)val;
+	dst[1] = (uint8_t)(val >> 8);
+}
+
+static void put_le32(uint8_t *dst, uint32_t val)
+{
+	put_le16(dst, (uint16_t)val);
+	put_le16(dst + 2, (uint16_t)(val >> 16));
+}
+
+static void put_le24(uint8_t *dst, uint32_t val)
+{
+	put_le16(dst, (uint16_t)val);
+	dst[2] = (uint8_t)(val >> 16);
+}
+
+static void put_le56(uint8_t *dst, uint64_t val)
+{
+	put_le32(dst, (uint32_t)val);
+	put_le24(dst + 4, (uint32_t)(val >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *src)
+{
+	return (uint16_t)(src[0] | (src[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *src)
+{
+	return get_le16(src) | ((uint32_t)get_le16(src + 2) << 16);
+}
+
+static uint32_t get_le24(const uint8_t *src)
+{
+	return get_le16(src) | ((uint32_t)src[2] << 16);
+}
+
+static uint64_t get_le56(const uint8_t *src)
+{
+	return get_le32(src) | ((uint64_t)get_le24(src + 4) << 32);
+}
+
+/* The destination bytes must be zero, bits are only ever OR-ed in */
+static void put_bits(uint8_t *buf, uint32_t *pos, uint32_t val, uint8_t bits)
+{
+	while (bits) {
+		uint8_t shift = *pos & 7U;
+		uint8_t n = 8U - shift;
+
+		if (n > bits) {
+			n = bits;
+		}
+
+		buf[*pos >> 3] |= (uint8_t)((val & ((1U << n) - 1U)) << shift);
+		val >>= n;
+		bits -= n;
+		*pos += n;
+	}
+}
+
+static uint32_t get_bits(const uint8_t *buf, uint32_t *pos, uint8_t bits)
+{
+	uint32_t val = 0U;
+	uint8_t done = 0U;
+
+	while (done < bits) {
+		uint8_t shift = *pos & 7U;
+		uint8_t n = 8U - shift;
+
+		if (n > bits - done) {
+			n = bits - done;
+		}
+
+		val |= (uint32_t)((buf[*pos >> 3] >> shift) & ((1U << n) - 1U))
+		       << done;
+		done += n;
+		*pos += n;
+	}
+
+	return val;
+}
+
+static uint32_t sample_bits(uint8_t mask)
+{
+	return (uint32_t)channel_count(mask) * SAMPLE_FRAME_VALUE_BITS;
+}
+
+/* Bounds checked get_bits() for decoding untrusted frames */
+static int take_bits(const uint8_t *buf, size_t len, uint32_t *pos,
+		     uint8_t bits, uint32_t *val)
+{
+	if (*pos + bits > len * 8U) {
+		return -EBADMSG;
+	}
+
+	*val = get_bits(buf, pos, bits);
+
+	return 0;
+}
+
+/* Rice parameter state adapts every RICE_RESET samples */
+#define RICE_RESET 32U
+#define RICE_SUM_INIT 2U
+#define RICE_K_MAX (SAMPLE_FRAME_VALUE_BITS - 1U)
+
+static void rice_reset(struct sample_frame_chan *c, uint16_t val)
+{
+	c->prev = val;
+	c->n = 1U;
+	c->sum = RICE_SUM_INIT;
+}
+
+static uint8_t rice_k(const struct sample_frame_chan *c)
+{
+	uint8_t k = 0U;
+
+	while (k < RICE_K_MAX && ((uint32_t)c->n << k) < c->sum) {
+		k++;
+	}
+
+	return k;
+}
+
+static void rice_update(struct sample_frame_chan *c, uint32_t zz,
+			uint16_t val)
+{
+	c->prev = val;
+	c->sum += zz;
+	if (++c->n == RICE_RESET) {
+		c->n >>= 1;
+		c->sum >>= 1;
+	}
+}
+
+static uint32_t zigzag(uint16_t val, uint16_t prev)
+{
+	int32_t d = (int32_t)val - (int32_t)prev;
+
+	return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static uint32_t rice_bits(uint32_t zz, uint8_t k)
+{
+	uint32_t q = zz >> k;
+
+	if (q >= SAMPLE_FRAME_RICE_ESCAPE) {
+		return SAMPLE_FRAME_RICE_ESCAPE + SAMPLE_FRAME_VALUE_BITS;
+	}
+
+	return q + 1U + k;
+}
+
+static void put_rice(uint8_t *buf, uint32_t *pos, uint32_t zz, uint8_t k,
+		     uint16_t val)
+{
+	uint32_t q = zz >> k;
+
+	if (q >= SAMPLE_FRAME_RICE_ESCAPE) {
+		put_bits(buf, pos, BIT_ONES(SAMPLE_FRAME_RICE_ESCAPE),
+			 SAMPLE_FRAME_RICE_ESCAPE);
+		put_bits(buf, pos, val, SAMPLE_FRAME_VALUE_BITS);
+		return;
+	}
+
+	/* Ones for the quotient, the terminating zero is already there */
+	put_bits(buf, pos, BIT_ONES(q), (uint8_t)q);
+	*pos += 1U;
+	put_bits(buf, pos, zz & BIT_ONES(k), k);
+}
+
+static int get_rice(const uint8_t *buf, size_t len, uint32_t *pos,
+		    struct sample_frame_chan *c, uint16_t *val)
+{
+	uint8_t k = rice_k(c);
+	uint32_t q = 0U;
+	uint32_t bit;
+	uint32_t zz;
+	int32_t d;
+	int err;
+
+	do {
+		err = take_bits(buf, len, pos, 1U, &bit);
+		if (err) {
+			return err;
+		}
+	} while (bit && ++q < SAMPLE_FRAME_RICE_ESCAPE);
+
+	if (q == SAMPLE_FRAME_RICE_ESCAPE) {
+		err = take_bits(buf, len, pos, SAMPLE_FRAME_VALUE_BITS, &zz);
+		if (err) {
+			return err;
+		}
+
+		*val = (uint16_t)zz;
+		zz = zigzag(*val, c->prev);
+	} else {
+		err = take_bits(buf, len, pos, k, &zz);
+		if (err) {
+			return err;
+		}
+
+		zz |= q << k;
+		d = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1U);
+		d += c->prev;
+		if (d < 0 || d > (int32_t)SAMPLE_FRAME_VALUE_MAX) {
+			return -EBADMSG;
+		}
+
+		*val = (uint16_t)d;
+	}
+
+	rice_update(c, zz, *val);
+
+	return 0;
+}
+
+int sample_frame_begin(struct sample_frame_enc *enc, uint8_t *buf,
+		       size_t size, uint8_t mask, uint8_t flags, uint32_t seq,
+		       uint64_t ticks, uint32_t period)
+{
+	size_t hdr_len = SAMPLE_FRAME_HDR_LEN;
+
+	if (flags & SAMPLE_FRAME_FLAG_DELTA) {
+		hdr_len++;
+	}
+
+	if (mask == 0U || flags > 0x0FU || size < hdr_len) {
+		return -EINVAL;
+	}
+
+	if (ticks > SAMPLE_FRAME_TICKS_MAX || period > SAMPLE_FRAME_PERIOD_MAX) {
+		return -ERANGE;
+	}
+
+	memset(buf, 0, size);
+
+	buf[0] = (uint8_t)(SAMPLE_FRAME_VERSION << 4) | flags;
+	buf[1] = mask;
+	put_le16(&buf[2], (uint16_t)seq);
+	put_le56(&buf[4], ticks);
+	put_le24(&buf[11], period);
+
+	enc->buf = buf;
+	enc->size = size;
+	enc->bitpos = hdr_len * 8U;
+	enc->mask = mask;
+	enc->flags = flags;
+	enc->count = 0U;
+	enc->next_seq = (uint16_t)seq;
+
+	return 0;
+}
+
+static uint16_t clamp_value(int16_t raw)
+{
+	/* Single ended inputs can read slightly below zero */
+	if (raw < 0) {
+		return 0U;
+	}
+
+	if (raw > (int32_t)SAMPLE_FRAME_VALUE_MAX) {
+		return SAMPLE_FRAME_VALUE_MAX;
+	}
+
+	return (uint16_t)raw;
+}
+
+static int add_delta(struct sample_frame_enc *enc, const int16_t *values)
+{
+	uint16_t val[SAMPLE_FRAME_MAX_CHANNELS];
+	uint32_t zz[SAMPLE_FRAME_MAX_CHANNELS];
+	uint8_t k[SAMPLE_FRAME_MAX_CHANNELS];
+	uint32_t bits = 0U;
+
+	if (enc->count == SAMPLE_FRAME_MAX_SAMPLES) {
+		return -ENOSPC;
+	}
+
+	for (uint8_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+		if (!(enc->mask & (1U << ch))) {
+			continue;
+		}
+
+		val[ch] = clamp_value(values[ch]);
+		if (enc->count == 0U) {
+			bits += SAMPLE_FRAME_VALUE_BITS;
+			continue;
+		}
+
+		zz[ch] = zigzag(val[ch], enc->chan[ch].prev);
+		k[ch] = rice_k(&enc->chan[ch]);
+		bits += rice_bits(zz[ch], k[ch]);
+	}
+
+	if (enc->bitpos + bits > enc->size * 8U) {
+		return -ENOSPC;
+	}
+
+	for (uint8_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+		if (!(enc->mask & (1U << ch))) {
+			continue;
+		}
+
+		if (enc->count == 0U) {
+			put_bits(enc->buf, &enc->bitpos, val[ch],
+				 SAMPLE_FRAME_VALUE_BITS);
+			rice_reset(&enc->chan[ch], val[ch]);
+			continue;
+		}
+
+		put_rice(enc->buf, &enc->bitpos, zz[ch], k[ch], val[ch]);
+		rice_update(&enc->chan[ch], zz[ch], val[ch]);
+	}
+
+	enc->buf[SAMPLE_FRAME_HDR_LEN] = enc->count + 1U;
+
+	return 0;
+}
+
+int sample_frame_add(struct sample_frame_enc *enc, uint32_t seq,
+		     const int16_t *values)
+{
+	int err;
+
+	if ((uint16_t)seq != enc->next_seq) {
+		return -ERANGE;
+	}
+
+	if (enc->flags & SAMPLE_FRAME_FLAG_DELTA) {
+		err = add_delta(enc, values);
+		if (err) {
+			return err;
+		}
+	} else {
+		if (sample_frame_full(enc)) {
+			return -ENOSPC;
+		}
+
+		for (uint8_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+			if (enc->mask & (1U << ch)) {
+				put_bits(enc->buf, &enc->bitpos,
+					 clamp_value(values[ch]),
+					 SAMPLE_FRAME_VALUE_BITS);
+			}
+		}
+	}
+
+	enc->count++;
+	enc->next_seq++;
+
+	return 0;
+}
+
+int sample_frame_full(const struct sample_frame_enc *enc)
+{
+	uint32_t bits = 0U;
+
+	if (!(enc->flags & SAMPLE_FRAME_FLAG_DELTA) || enc->count == 0U) {
+		return enc->bitpos + sample_bits(enc->mask) > enc->size * 8U;
+	}
+
+	if (enc->count == SAMPLE_FRAME_MAX_SAMPLES) {
+		return 1;
+	}
+
+	/* Smallest possible sample, every channel unchanged */
+	for (uint8_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+		if (enc->mask & (1U << ch)) {
+			bits += 1U + rice_k(&enc->chan[ch]);
+		}
+	}
+
+	return enc->bitpos + bits > enc->size * 8U;
+}
+
+size_t sample_frame_len(const struct sample_frame_enc *enc)
+{
+	return (enc->bitpos + 7U) / 8U;
+}
+
+int sample_frame_parse(const uint8_t *buf, size_t len,
+		       struct sample_frame_hdr *hdr)
+{
+	if (len < SAMPLE_FRAME_HDR_LEN) {
+		return -EMSGSIZE;
+	}
+
+	hdr->version = buf[0] >> 4;
+	hdr->flags = buf[0] & 0x0FU;
+	hdr->mask = buf[1];
+	hdr->seq = get_le16(&buf[2]);
+	hdr->ticks = get_le56(&buf[4]);
+	hdr->period = get_le24(&buf[11]);
+
+	if (hdr->version != SAMPLE_FRAME_VERSION) {
+		return -ENOTSUP;
+	}
+
+	if (hdr->mask == 0U) {
+		return -EINVAL;
+	}
+
+	if (hdr->flags & SAMPLE_FRAME_FLAG_DELTA) {
+		if (len < SAMPLE_FRAME_HDR_LEN + 1U) {
+			return -EMSGSIZE;
+		}
+
+		return buf[SAMPLE_FRAME_HDR_LEN];
+	}
+
+	return (int)(((len - SAMPLE_FRAME_HDR_LEN) * 8U) /
+		     sample_bits(hdr->mask));
+}
+
+int sample_frame_decode(const uint8_t *buf, size_t len,
+			struct sample_frame_hdr *hdr, uint16_t *out,
+			size_t out_len)
+{
+	struct sample_frame_chan chan[SAMPLE_FRAME_MAX_CHANNELS];
+	uint32_t pos = SAMPLE_FRAME_HDR_LEN * 8U;
+	uint32_t val;
+	uint8_t nch;
+	int count;
+	int err;
+
+	count = sample_frame_parse(buf, len, hdr);
+	if (count < 0) {
+		return count;
+	}
+
+	nch = channel_count(hdr->mask);
+	if ((size_t)count * nch > out_len) {
+		return -ENOBUFS;
+	}
+
+	if (!(hdr->flags & SAMPLE_FRAME_FLAG_DELTA)) {
+		for (size_t i = 0U; i < (size_t)count * nch; i++) {
+			out[i] = (uint16_t)get_bits(buf, &pos,
+						    SAMPLE_FRAME_VALUE_BITS);
+		}
+
+		return count;
+	}
+
+	pos += 8U;
+
+	for (int i = 0; i < count; i++) {
+		for (uint8_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+			if (!(hdr->mask & (1U << ch))) {
+				continue;
+			}
+
+			if (i == 0) {
+				err = take_bits(buf, len, &pos,
+						SAMPLE_FRAME_VALUE_BITS, &val);
+				if (err) {
+					return err;
+				}
+
+				*out = (uint16_t)val;
+				rice_reset(&chan[ch], *out);
+			} else {
+				err = get_rice(buf, len, &pos, &chan[ch], out);
+				if (err) {
+					return err;
+				}
+			}
+
+			out++;
+		}
+	}
+
+	return count;
+}
@@ -0,0 +1,141 @@
+/** @file
+ *  @brief Binary sample frame format
+ *
+ *  Shared by the firmware encoder and host-side decoders. Only depends
+ *  on the C standard library so it can be compiled as C or C++ on any
+ *  host.
+ *
+ *  A frame is one notification payload, all fields little endian:
+ *
+ *    0      version (high nibble) | flags (low nibble)
+ *    1      channel mask, bit n set if io-channel n is present
+ *    2..3   sequence number of the first sample
+ *    4..10  device timestamp of the first sample (56 bits), in kernel
+ *           ticks since boot (monotonic, never wraps), or since
+ *           1970-01-01 if SAMPLE_FRAME_FLAG_EPOCH is set
+ *    11..13 sample period in kernel ticks (24 bits)
+ *    14..   samples, each holding one 12-bit value per channel in the
+ *           mask (lowest channel first), packed LSB first with no
+ *           padding between values
+ *
+ *  Samples inside a frame have consecutive sequence numbers and are one
+ *  period apart, so sample i was taken at timestamp + i * period. The
+ *  sample count is implied by the payload length, the unused bits of
+ *  the last byte are zero.
+ *
+ *  Frames with SAMPLE_FRAME_FLAG_DELTA set are compressed instead:
+ *
+ *    14     sample count
+ *    15..   first sample packed as above, then for every further sample
+ *           and channel the difference to the previous value of that
+ *           channel, zigzag mapped and Rice coded
+ *
+ *  A Rice code with parameter k is q = value >> k one bits, a zero bit
+ *  and the low k bits of the value. Quotients of SAMPLE_FRAME_RICE_ESCAPE
+ *  or more are sent as that many one bits followed by the plain 12-bit
+ *  sample. k starts at 1 for every channel and frame and is derived
+ *  from the mean of the values coded so far, as in JPEG-LS, so it is
+ *  never transmitted.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SAMPLE_FRAME_H_
+#define SAMPLE_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLE_FRAME_VERSION 3U
+#define SAMPLE_FRAME_HDR_LEN 14U
+#define SAMPLE_FRAME_TICKS_MAX ((UINT64_C(1) << 56) - 1U)
+#define SAMPLE_FRAME_PERIOD_MAX ((UINT32_C(1) << 24) - 1U)
+#define SAMPLE_FRAME_MAX_CHANNELS 8U
+#define SAMPLE_FRAME_VALUE_BITS 12U
+#define SAMPLE_FRAME_VALUE_MAX ((1U << SAMPLE_FRAME_VALUE_BITS) - 1U)
+
+/* Timestamp is wall clock time as set through the Current Time Service */
+#define SAMPLE_FRAME_FLAG_EPOCH 0x01U
+/* Samples are delta and Rice coded */
+#define SAMPLE_FRAME_FLAG_DELTA 0x02U
+/* Logged to flash while no client listened, replayed late */
+#define SAMPLE_FRAME_FLAG_BACKFILL 0x04U
+
+#define SAMPLE_FRAME_RICE_ESCAPE 8U
+#define SAMPLE_FRAME_MAX_SAMPLES UINT8_MAX
+
+struct sample_frame_hdr {
+	uint8_t version;
+	uint8_t flags;
+	uint8_t mask;
+	uint16_t seq;
+	uint32_t period;
+	uint64_t ticks;
+};
+
+/* Per-channel predictor and Rice parameter state of a delta frame */
+struct sample_frame_chan {
+	uint16_t prev;
+	uint8_t n;
+	uint32_t sum;
+};
+
+struct sample_frame_enc {
+	uint8_t *buf;
+	size_t size;
+	uint32_t bitpos;
+	uint8_t mask;
+	uint8_t flags;
+	uint8_t count;
+	uint16_t next_seq;
+	struct sample_frame_chan chan[SAMPLE_FRAME_MAX_CHANNELS];
+};
+
+/* Starts a frame in buf. size bounds the whole frame, header included.
+ * Returns -ERANGE if ticks or period exceed what the header carries.
+ */
+int sample_frame_begin(struct sample_frame_enc *enc, uint8_t *buf,
+		       size_t size, uint8_t mask, uint8_t flags, uint32_t seq,
+		       uint64_t ticks, uint32_t period);
+
+/* Appends one sample. values is indexed by io-channel and must cover
+ * every channel in the mask. Returns -ERANGE if seq does not follow the
+ * previous sample and -ENOSPC if the sample does not fit; the frame is
+ * left unchanged in both cases.
+ */
+int sample_frame_add(struct sample_frame_enc *enc, uint32_t seq,
+		     const int16_t *values);
+
+/* True if another sample cannot fit in the frame. A delta frame may
+ * still reject a sample that differs a lot from the previous one.
+ */
+int sample_frame_full(const struct sample_frame_enc *enc);
+
+/* Number of bytes used so far */
+size_t sample_frame_len(const struct sample_frame_enc *enc);
+
+/* Parses the header and returns the number of samples in the frame, or
+ * a negative errno value if the frame is malformed.
+ */
+int sample_frame_parse(const uint8_t *buf, size_t len,
+		       struct sample_frame_hdr *hdr);
+
+/* Decodes every sample into out, row major with one entry per channel
+ * in the mask. Returns the number of samples decoded or a negative
+ * errno value.
+ */
+int sample_frame_decode(const uint8_t *buf, size_t len,
+			struct sample_frame_hdr *hdr, uint16_t *out,
+			size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_FRAME_H_ */
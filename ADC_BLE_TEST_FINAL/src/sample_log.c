@@ -0,0 +1,518 @@
+/** @file
+ *  @brief Flash log of sample frames taken while no client listens
+ *
+ *  Frames are appended whole to a flash circular buffer (FCB) in the
+ *  sample_log_partition. The FCB writes sectors in turn and erases the
+ *  oldest one when it runs out of room, so wear is spread over the
+ *  whole partition.
+ *
+ *  A read cursor marks the last frame replayed to a client. Sectors
+ *  behind it are erased as soon as the cursor leaves them; if the log
+ *  fills up first, the oldest frames are lost and counted.
+ *
+ *  For bulk reads the frames after the cursor also form one byte
+ *  stream, each frame preceded by its u16 length. Offsets into it count
+ *  from the first frame logged since boot, so they stay put while the
+ *  frames before them are released. A boot ID kept in the settings
+ *  tells a client which boot the offsets it holds belong to.
+ *
+ *  The sender thread appends and replays, the transfer service reads
+ *  and releases; a mutex keeps the cursor consistent between them.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/fs/fcb.h>
+#include <zephyr/settings/settings.h>
+
+#include "sample_log.h"
+
+LOG_MODULE_REGISTER(sample_log, CONFIG_APP_LOG_LEVEL);
+
+#define LOG_AREA_ID FIXED_PARTITION_ID(sample_log_partition)
+#define LOG_MAGIC 0x53414d50 /* "SAMP" */
+#define LOG_VERSION 1
+#define LOG_MAX_SECTORS 64U
+#define RECORD_HDR_LEN 2U
+#define BOOT_ID_KEY "sample_log/boot"
+
+static struct flash_sector sectors[LOG_MAX_SECTORS];
+static struct fcb fcb;
+static K_MUTEX_DEFINE(log_lock);
+/* Frames are dropped as before if the partition could not be mounted */
+static bool ready;
+
+/* Last frame replayed, fe_sector is NULL before the oldest frame */
+static struct fcb_entry cursor;
+/* Stream offsets of the frame after the cursor and of the log's end */
+static uint32_t start_off;
+static uint32_t end_off;
+
+/* Frame handed out by sample_log_peek() and its stream offset */
+static struct fcb_entry peeked;
+static uint32_t peeked_off;
+
+/* Frame before the last bulk read position, so sequential reads do
+ * not walk the log from the cursor every time. Invalid after a rotate.
+ */
+static struct fcb_entry reader;
+static uint32_t reader_off;
+static bool reader_valid;
+
+static atomic_t held;
+
+/* 0 if it could not be stored */
+static uint32_t boot_id;
+
+static atomic_t logged;
+static atomic_t replayed;
+static atomic_t overwritten;
+static atomic_t pending;
+
+static int rotate(void)
+{
+	reader_valid = false;
+
+	return fcb_rotate(&fcb);
+}
+
+/* Frames after the cursor that live in the oldest sector */
+static uint32_t unreplayed_in_oldest(uint32_t *len)
+{
+	struct fcb_entry loc = cursor;
+	uint32_t n = 0U;
+
+	*len = 0U;
+
+	while (fcb_getnext(&fcb, &loc) == 0 && loc.fe_sector == fcb.f_oldest) {
+		*len += RECORD_HDR_LEN + loc.fe_data_len;
+		n++;
+	}
+
+	return n;
+}
+
+static int drop_oldest(void)
+{
+	uint32_t len;
+	uint32_t lost = unreplayed_in_oldest(&len);
+	int err;
+
+	if (cursor.fe_sector == fcb.f_oldest) {
+		cursor.fe_sector = NULL;
+	}
+
+	err = rotate();
+	if (err) {
+		return err;
+	}
+
+	start_off += len;
+	atomic_add(&overwritten, lost);
+	atomic_sub(&pending, lost);
+
+	return 0;
+}
+
+/* Moves the cursor onto loc, the frame right after it */
+static void advance(const struct fcb_entry *loc)
+{
+	cursor = *loc;
+	start_off += RECORD_HDR_LEN + loc->fe_data_len;
+
+	atomic_inc(&replayed);
+	atomic_dec(&pending);
+
+	/* Every sector behind the cursor has been replayed */
+	while (cursor.fe_sector != fcb.f_oldest) {
+		if (rotate() != 0) {
+			break;
+		}
+	}
+}
+
+int sample_log_append(const uint8_t *frame, size_t len)
+{
+	struct fcb_entry loc;
+	int err;
+
+	if (!ready) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	err = fcb_append(&fcb, len, &loc);
+	if (err == -ENOSPC) {
+		err = drop_oldest();
+		if (!err) {
+			err = fcb_append(&fcb, len, &loc);
+		}
+	}
+
+	if (!err) {
+		err = flash_area_write(fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc),
+				       frame, len);
+	}
+
+	if (!err) {
+		err = fcb_append_finish(&fcb, &loc);
+	}
+
+	if (!err) {
+		end_off += RECORD_HDR_LEN + len;
+		atomic_inc(&logged);
+		atomic_inc(&pending);
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	return err;
+}
+
+int sample_log_peek(uint8_t *buf, size_t size)
+{
+	int err;
+
+	if (sample_log_empty()) {
+		return 0;
+	}
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	peeked = cursor;
+	peeked_off = start_off;
+
+	err = fcb_getnext(&fcb, &peeked);
+	if (err) {
+		/* Counted as pending but gone, e.g. a corrupted entry */
+		atomic_set(&pending, 0);
+		err = 0;
+	} else if (peeked.fe_data_len > size) {
+		err = -EMSGSIZE;
+	} else {
+		err = fcb_flash_read(&fcb, peeked.fe_sector,
+				     peeked.fe_data_off, buf,
+				     peeked.fe_data_len);
+		if (!err) {
+			err = peeked.fe_data_len;
+		}
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	return err;
+}
+
+void sample_log_pop(void)
+{
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	/* Unless a bulk release or a full log got rid of it meanwhile */
+	if (peeked_off == start_off) {
+		advance(&peeked);
+	}
+
+	k_mutex_unlock(&log_lock);
+}
+
+bool sample_log_empty(void)
+{
+	return atomic_get(&pending) <= 0;
+}
+
+void sample_log_hold(bool hold)
+{
+	atomic_set(&held, hold);
+}
+
+bool sample_log_held(void)
+{
+	return atomic_get(&held);
+}
+
+void sample_log_range(uint32_t *start, uint32_t *end)
+{
+	k_mutex_lock(&log_lock, K_FOREVER);
+	*start = start_off;
+	*end = end_off;
+	k_mutex_unlock(&log_lock);
+}
+
+/* Copies the part of the record at loc, starting at stream offset rec_off,
+ * that lies from off on into buf. Returns the bytes copied.
+ */
+static int read_record(const struct fcb_entry *loc, uint32_t rec_off,
+		       uint32_t off, uint8_t *buf, size_t len)
+{
+	uint32_t in = off - rec_off;
+	size_t n = 0U;
+	int err;
+
+	while (in < RECORD_HDR_LEN && n < len) {
+		buf[n++] = loc->fe_data_len >> (8U * in);
+		in++;
+	}
+
+	if (n < len && in < RECORD_HDR_LEN + loc->fe_data_len) {
+		size_t part = MIN(len - n,
+				  RECORD_HDR_LEN + loc->fe_data_len - in);
+
+		err = fcb_flash_read(&fcb, loc->fe_sector,
+				     loc->fe_data_off + in - RECORD_HDR_LEN,
+				     &buf[n], part);
+		if (err) {
+			return err;
+		}
+
+		n += part;
+	}
+
+	return n;
+}
+
+int sample_log_read(uint32_t off, uint8_t *buf, size_t len)
+{
+	struct fcb_entry loc;
+	size_t n = 0U;
+	int err = 0;
+
+	if (!ready) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	if ((int32_t)(off - start_off) < 0) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	if (!reader_valid || (int32_t)(off - reader_off) < 0) {
+		reader = cursor;
+		reader_off = start_off;
+		reader_valid = true;
+	}
+
+	while (n < len && (int32_t)(end_off - off) > 0) {
+		uint32_t rec_len;
+
+		loc = reader;
+		if (fcb_getnext(&fcb, &loc) != 0) {
+			break;
+		}
+
+		rec_len = RECORD_HDR_LEN + loc.fe_data_len;
+
+		if (off - reader_off < rec_len) {
+			err = read_record(&loc, reader_off, off, &buf[n],
+					  len - n);
+			if (err < 0) {
+				goto out;
+			}
+
+			n += err;
+			off += err;
+			err = 0;
+		}
+
+		if (off - reader_off < rec_len) {
+			/* buf is full in the middle of this record */
+			break;
+		}
+
+		reader = loc;
+		reader_off += rec_len;
+	}
+
+out:
+	k_mutex_unlock(&log_lock);
+
+	return err ? err : n;
+}
+
+int sample_log_release(uint32_t off)
+{
+	struct fcb_entry loc;
+	int n = 0;
+
+	if (!ready) {
+		return -ENODEV;
+	}
+
+	k_mutex_lock(&log_lock, K_FOREVER);
+
+	while (1) {
+		loc = cursor;
+		if (fcb_getnext(&fcb, &loc) != 0 ||
+		    (int32_t)(off - start_off) <
+		    (int32_t)(RECORD_HDR_LEN + loc.fe_data_len)) {
+			break;
+		}
+
+		advance(&loc);
+		n++;
+	}
+
+	k_mutex_unlock(&log_lock);
+
+	return n;
+}
+
+uint32_t sample_log_boot_id(void)
+{
+	return boot_id;
+}
+
+void sample_log_get_stats(struct sample_log_stats *stats)
+{
+	stats->logged = atomic_get(&logged);
+	stats->replayed = atomic_get(&replayed);
+	stats->overwritten = atomic_get(&overwritten);
+	stats->pending = MAX(atomic_get(&pending), 0);
+}
+
+/* The FCB expects erased sectors. Only ones holding something else, e.g.
+ * an image from an earlier layout, are erased so a blank log costs no
+ * erase time at boot.
+ */
+static int erase_dirty_sectors(const struct flash_area *fa, uint32_t count)
+{
+	uint8_t erased = flash_area_erased_val(fa);
+	uint8_t chunk[64];
+	int err;
+
+	for (uint32_t i = 0U; i < count; i++) {
+		for (size_t off = 0U; off < sectors[i].fs_size;
+		     off += sizeof(chunk)) {
+			bool dirty = false;
+
+			err = flash_area_read(fa, sectors[i].fs_off + off,
+					      chunk, sizeof(chunk));
+			if (err) {
+				return err;
+			}
+
+			for (size_t j = 0U; j < sizeof(chunk); j++) {
+				dirty |= chunk[j] != erased;
+			}
+
+			if (dirty) {
+				err = flash_area_erase(fa, sectors[i].fs_off,
+						       sectors[i].fs_size);
+				if (err) {
+					return err;
+				}
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int load_boot_id(const char *key, size_t len,
+			settings_read_cb read_cb, void *cb_arg, void *param)
+{
+	if (len != sizeof(boot_id)) {
+		return -EINVAL;
+	}
+
+	return (read_cb(cb_arg, &boot_id, len) == len) ? 0 : -EIO;
+}
+
+/* Counts this boot on from the last stored one */
+static void next_boot_id(void)
+{
+	int err = -ENOTSUP;
+
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		err = settings_subsys_init();
+		if (!err) {
+			err = settings_load_subtree_direct(BOOT_ID_KEY,
+							   load_boot_id, NULL);
+		}
+	}
+
+	if (!err) {
+		/* Skips 0 when the counter wraps */
+		boot_id = MAX(boot_id + 1U, 1U);
+		err = settings_save_one(BOOT_ID_KEY, &boot_id,
+					sizeof(boot_id));
+	}
+
+	if (err) {
+		LOG_WRN("Boot ID not stored (err %d)", err);
+		boot_id = 0U;
+	}
+}
+
+int sample_log_init(void)
+{
+	const struct flash_area *fa;
+	struct fcb_entry loc = { 0 };
+	uint32_t count = ARRAY_SIZE(sectors);
+	int err;
+
+	next_boot_id();
+
+	err = flash_area_get_sectors(LOG_AREA_ID, &count, sectors);
+	if (err) {
+		LOG_ERR("Log partition layout unusable (err %d)", err);
+		return err;
+	}
+
+	fcb.f_magic = LOG_MAGIC;
+	fcb.f_version = LOG_VERSION;
+	fcb.f_sector_cnt = count;
+	fcb.f_scratch_cnt = 0U;
+	fcb.f_sectors = sectors;
+
+	err = fcb_init(LOG_AREA_ID, &fcb);
+	if (err == 0 && !fcb_is_empty(&fcb)) {
+		/* Timestamps of an earlier boot count from a different
+		 * uptime origin and cannot be placed. They are skipped and
+		 * their sectors reclaimed as the log wraps.
+		 */
+		while (fcb_getnext(&fcb, &loc) == 0) {
+			cursor = loc;
+		}
+
+		LOG_INF("Log holds frames of an earlier boot, skipped");
+		ready = true;
+		return 0;
+	}
+
+	err = flash_area_open(LOG_AREA_ID, &fa);
+	if (err) {
+		return err;
+	}
+
+	err = erase_dirty_sectors(fa, count);
+	flash_area_close(fa);
+	if (err) {
+		LOG_ERR("Log partition erase failed (err %d)", err);
+		return err;
+	}
+
+	err = fcb_init(LOG_AREA_ID, &fcb);
+	if (err) {
+		LOG_ERR("Log init failed (err %d)", err);
+		return err;
+	}
+
+	LOG_INF("Sample log: %u sectors", count);
+	ready = true;
+
+	return 0;
+}
@@ -0,0 +1,78 @@
+/** @file
+ *  @brief Flash log of sample frames taken while no client listens
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SAMPLE_LOG_H_
+#define SAMPLE_LOG_H_
+
+#include <zephyr/types.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sample_log_stats {
+	/* Frames written to flash */
+	uint32_t logged;
+	/* Frames sent back to a client and released */
+	uint32_t replayed;
+	/* Frames erased before they were replayed because the log was full */
+	uint32_t overwritten;
+	/* Frames in the log waiting to be replayed */
+	uint32_t pending;
+};
+
+/* Mounts the log partition. Frames an earlier boot left behind are
+ * skipped, their sectors are reclaimed as the log wraps.
+ */
+int sample_log_init(void);
+
+/* Appends a frame, erasing the oldest sector if the log is full */
+int sample_log_append(const uint8_t *frame, size_t len);
+
+/* Copies the oldest frame not yet replayed into buf. Returns its
+ * length, 0 if the log is empty or a negative errno value.
+ */
+int sample_log_peek(uint8_t *buf, size_t size);
+
+/* Releases the frame returned by the last sample_log_peek() */
+void sample_log_pop(void);
+
+bool sample_log_empty(void);
+
+/* Holds or resumes the replay, e.g. while a client downloads the log */
+void sample_log_hold(bool hold);
+
+bool sample_log_held(void);
+
+/* Stream offsets of the first frame not yet replayed and of the end of
+ * the log. Frames are read back as a u16 length followed by the frame.
+ */
+void sample_log_range(uint32_t *start, uint32_t *end);
+
+/* Copies up to len bytes of the stream from off on into buf. Returns the
+ * bytes copied, 0 at the end of the log, -ENOENT if off was released or
+ * overwritten or another negative errno value.
+ */
+int sample_log_read(uint32_t off, uint8_t *buf, size_t len);
+
+/* Releases the frames that end at or before off. Returns their number. */
+int sample_log_release(uint32_t off);
+
+/* Numbers the boots the stream offsets count from, 0 if the number
+ * could not be stored and offsets of different boots look alike
+ */
+uint32_t sample_log_boot_id(void);
+
+void sample_log_get_stats(struct sample_log_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_LOG_H_ */
@@ -0,0 +1,91 @@
+/** @file
+ *  @brief Single producer, single consumer ring of ADC scans
+ *
+ *  The producer only ever writes head and the consumer only ever writes
+ *  tail, so neither side takes a lock. The semaphore just lets the
+ *  consumer sleep while the ring is empty.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include "sample_ring.h"
+
+#define RING_SIZE CONFIG_APP_SAMPLE_RING_SIZE
+#define RING_MASK (RING_SIZE - 1U)
+
+BUILD_ASSERT((RING_SIZE & RING_MASK) == 0U,
+	     "CONFIG_APP_SAMPLE_RING_SIZE must be a power of two");
+
+static struct sampler_scan slots[RING_SIZE];
+
+/* Free running indices, only the low bits address a slot */
+static atomic_t head;
+static atomic_t tail;
+
+static K_SEM_DEFINE(ring_sem, 0, RING_SIZE);
+
+static atomic_t puts;
+static atomic_t overflows;
+static atomic_t high_water;
+
+struct sampler_scan *sample_ring_put_claim(void)
+{
+	uint32_t h = (uint32_t)atomic_get(&head);
+	uint32_t t = (uint32_t)atomic_get(&tail);
+
+	if (h - t >= RING_SIZE) {
+		atomic_inc(&overflows);
+		return NULL;
+	}
+
+	return &slots[h & RING_MASK];
+}
+
+void sample_ring_put_commit(void)
+{
+	uint32_t h = (uint32_t)atomic_get(&head) + 1U;
+	uint32_t fill = h - (uint32_t)atomic_get(&tail);
+
+	atomic_set(&head, h);
+	atomic_inc(&puts);
+
+	if (fill > (uint32_t)atomic_get(&high_water)) {
+		atomic_set(&high_water, fill);
+	}
+
+	k_sem_give(&ring_sem);
+}
+
+struct sampler_scan *sample_ring_get_claim(k_timeout_t timeout)
+{
+	if (k_sem_take(&ring_sem, timeout) != 0) {
+		return NULL;
+	}
+
+	return &slots[(uint32_t)atomic_get(&tail) & RING_MASK];
+}
+
+void sample_ring_get_finish(void)
+{
+	atomic_inc(&tail);
+}
+
+uint32_t sample_ring_count(void)
+{
+	return (uint32_t)atomic_get(&head) - (uint32_t)atomic_get(&tail);
+}
+
+void sample_ring_get_stats(struct sample_ring_stats *stats)
+{
+	stats->puts = atomic_get(&puts);
+	stats->overflows = atomic_get(&overflows);
+	stats->high_water = atomic_get(&high_water);
+}
@@ -0,0 +1,51 @@
+/** @file
+ *  @brief Single producer, single consumer ring of ADC scans
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SAMPLE_RING_H_
+#define SAMPLE_RING_H_
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sample_ring_stats {
+	/* Scans committed by the producer */
+	uint32_t puts;
+	/* Scans the producer had to drop because the ring was full */
+	uint32_t overflows;
+	/* Highest number of scans ever waiting in the ring */
+	uint32_t high_water;
+};
+
+/* Producer side. put_claim returns NULL, and counts an overflow, when
+ * the ring is full. A claimed slot is only visible to the consumer
+ * after put_commit.
+ */
+struct sampler_scan *sample_ring_put_claim(void);
+void sample_ring_put_commit(void);
+
+/* Consumer side. get_claim waits up to timeout for a scan and returns
+ * NULL if none arrived. The slot stays owned by the consumer until
+ * get_finish.
+ */
+struct sampler_scan *sample_ring_get_claim(k_timeout_t timeout);
+void sample_ring_get_finish(void);
+
+uint32_t sample_ring_count(void);
+void sample_ring_get_stats(struct sample_ring_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_RING_H_ */
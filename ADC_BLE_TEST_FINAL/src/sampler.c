@@ -0,0 +1,433 @@
+/** @file
+ *  @brief Timer driven multi-channel ADC sampler
+ *
+ *  A periodic k_timer releases the sampler thread, which converts the
+ *  enabled zephyr,user io-channels due in that period in one
+ *  adc_sequence. The timer period is anchored to the kernel tick, so
+ *  the time spent converting or in the consumer callback does not
+ *  accumulate as drift.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/sys/util.h>
+
+#include "sampler.h"
+
+LOG_MODULE_REGISTER(sampler, CONFIG_APP_LOG_LEVEL);
+
+#if !DT_NODE_EXISTS(DT_PATH(zephyr_user)) || \
+	!DT_NODE_HAS_PROP(DT_PATH(zephyr_user), io_channels)
+#error "No suitable devicetree overlay specified"
+#endif
+
+#define DT_SPEC_AND_COMMA(node_id, prop, idx) \
+	ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
+
+/* Data of ADC io-channels specified in devicetree. */
+static const struct adc_dt_spec adc_channels[] = {
+	DT_FOREACH_PROP_ELEM(DT_PATH(zephyr_user), io_channels,
+			     DT_SPEC_AND_COMMA)
+};
+
+BUILD_ASSERT(ARRAY_SIZE(adc_channels) == SAMPLER_NUM_CHANNELS);
+
+/* The driver stores results in ascending channel_id order, which is not
+ * necessarily the io-channels order. buf_index maps one onto the other
+ * for the channels of the current sequence.
+ */
+static int16_t scan_buf[SAMPLER_NUM_CHANNELS];
+static uint8_t buf_index[SAMPLER_NUM_CHANNELS];
+
+static struct adc_sequence sequence = {
+	.buffer = scan_buf,
+	/* buffer size in bytes, not number of samples */
+	.buffer_size = sizeof(scan_buf),
+};
+
+static sampler_cb_t scan_cb;
+static uint32_t rate_hz;
+/* Channel selection, read by the sampler thread before every scan */
+static uint8_t chan_mask = BIT_MASK(SAMPLER_NUM_CHANNELS);
+static uint8_t chan_divisor[SAMPLER_NUM_CHANNELS];
+static uint32_t window = 1U;
+static uint32_t period_ticks;
+static bool running;
+
+static K_SEM_DEFINE(sample_sem, 0, 1);
+static struct k_spinlock lock;
+
+/* Written by the timer expiry, consumed by the sampler thread */
+static uint32_t due_seq;
+static uint32_t due_cyc;
+static int64_t due_ticks;
+
+static struct sampler_stats stats;
+
+static void sample_timer_expiry(struct k_timer *timer)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	/* The previous scan has not started yet, its slot is lost */
+	if (k_sem_count_get(&sample_sem) != 0U) {
+		stats.overruns++;
+	}
+
+	due_seq++;
+	due_cyc = k_cycle_get_32();
+	due_ticks = k_uptime_ticks();
+
+	k_spin_unlock(&lock, key);
+
+	k_sem_give(&sample_sem);
+}
+
+static K_TIMER_DEFINE(sample_timer, sample_timer_expiry, NULL);
+
+static void sampler_reset_stats(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	memset(&stats, 0, sizeof(stats));
+	stats.period_min_cyc = UINT32_MAX;
+
+	k_spin_unlock(&lock, key);
+}
+
+/* Called with lock held */
+static uint8_t scan_mask(uint32_t seq)
+{
+	uint32_t idx = seq / window;
+	uint8_t mask = 0U;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		if ((chan_mask & BIT(i)) && (idx % chan_divisor[i]) == 0U) {
+			mask |= BIT(i);
+		}
+	}
+
+	return mask;
+}
+
+/* Points the ADC sequence at the channels in mask, sampler thread only */
+static void build_sequence(uint8_t mask)
+{
+	uint32_t channels = 0U;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		if (mask & BIT(i)) {
+			channels |= BIT(adc_channels[i].channel_id);
+		}
+	}
+
+	if (channels == sequence.channels) {
+		return;
+	}
+
+	sequence.channels = channels;
+	sequence.buffer_size = popcount(channels) * sizeof(scan_buf[0]);
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		uint32_t below = channels &
+				 BIT_MASK(adc_channels[i].channel_id);
+
+		buf_index[i] = popcount(below);
+	}
+
+	/* The SAADC averages over every enabled channel, so hardware
+	 * oversampling is only usable while a single channel is scanned
+	 */
+	sequence.oversampling = (popcount(channels) == 1U) ?
+				CONFIG_APP_ADC_OVERSAMPLING : 0U;
+}
+
+static void sampler_thread(void *p1, void *p2, void *p3)
+{
+	struct sampler_scan scan;
+	uint32_t last_start_cyc = 0U;
+	uint32_t start_cyc;
+	uint32_t scan_cyc;
+	k_spinlock_key_t key;
+	int err;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		k_sem_take(&sample_sem, K_FOREVER);
+
+		key = k_spin_lock(&lock);
+		scan.seq = due_seq;
+		scan.ticks = due_ticks;
+		scan.period_ticks = period_ticks;
+		scan.mask = scan_mask(due_seq);
+		memcpy(scan.divisor, chan_divisor, sizeof(scan.divisor));
+		scan_cyc = due_cyc;
+		k_spin_unlock(&lock, key);
+
+		/* Nothing to convert in this period */
+		if (scan.mask == 0U) {
+			continue;
+		}
+
+		build_sequence(scan.mask);
+
+		start_cyc = k_cycle_get_32();
+
+		err = adc_read(adc_channels[0].dev, &sequence);
+
+		key = k_spin_lock(&lock);
+		if (err < 0) {
+			stats.errors++;
+		} else {
+			if (stats.scans != 0U) {
+				uint32_t period = start_cyc - last_start_cyc;
+
+				stats.period_min_cyc = MIN(stats.period_min_cyc, period);
+				stats.period_max_cyc = MAX(stats.period_max_cyc, period);
+			}
+			stats.latency_max_cyc = MAX(stats.latency_max_cyc,
+						    start_cyc - scan_cyc);
+			stats.scans++;
+			last_start_cyc = start_cyc;
+		}
+		k_spin_unlock(&lock, key);
+
+		if (err < 0) {
+			continue;
+		}
+
+		for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+			scan.raw[i] = (scan.mask & BIT(i)) ?
+				      scan_buf[buf_index[i]] : 0;
+		}
+
+		if (scan_cb) {
+			scan_cb(&scan);
+		}
+	}
+}
+
+K_THREAD_DEFINE(sampler_tid, CONFIG_APP_SAMPLER_STACK_SIZE, sampler_thread,
+		NULL, NULL, NULL, CONFIG_APP_SAMPLER_PRIORITY, 0, 0);
+
+int sampler_init(sampler_cb_t cb)
+{
+	int err;
+
+	/* Configure channels individually prior to sampling. */
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		if (!device_is_ready(adc_channels[i].dev)) {
+			LOG_ERR("ADC controller device %s not ready",
+				adc_channels[i].dev->name);
+			return -ENODEV;
+		}
+
+		/* A single sequence can only scan channels of one controller */
+		if (adc_channels[i].dev != adc_channels[0].dev) {
+			LOG_ERR("Channel #%d is not on %s", i,
+				adc_channels[0].dev->name);
+			return -EINVAL;
+		}
+
+		err = adc_channel_setup_dt(&adc_channels[i]);
+		if (err < 0) {
+			LOG_ERR("Could not setup channel #%d (%d)", i, err);
+			return err;
+		}
+	}
+
+	err = adc_sequence_init_dt(&adc_channels[0], &sequence);
+	if (err < 0) {
+		return err;
+	}
+
+	/* Leaves the first build_sequence() nothing to skip, so it also
+	 * sets the buffer layout and oversampling for channel 0 alone
+	 */
+	sequence.channels = 0U;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		chan_divisor[i] = 1U;
+	}
+
+	if (CONFIG_APP_ADC_OVERSAMPLING != 0 && SAMPLER_NUM_CHANNELS > 1) {
+		LOG_WRN("Oversampling only applies while one channel is enabled");
+	}
+
+	err = sampler_set_channels(CONFIG_APP_SAMPLE_CHANNELS &
+				   BIT_MASK(SAMPLER_NUM_CHANNELS), chan_divisor);
+	if (err) {
+		return err;
+	}
+
+	scan_cb = cb;
+	sampler_reset_stats();
+
+	return 0;
+}
+
+static void sampler_arm(void)
+{
+	k_spinlock_key_t key;
+
+	sampler_reset_stats();
+
+	/* K_USEC() rounds up to whole ticks, this is the real period */
+	key = k_spin_lock(&lock);
+	period_ticks = k_us_to_ticks_ceil32(USEC_PER_SEC / rate_hz);
+	k_spin_unlock(&lock, key);
+
+	k_timer_start(&sample_timer, K_TICKS(period_ticks),
+		      K_TICKS(period_ticks));
+}
+
+int sampler_set_rate(uint32_t hz)
+{
+	if (hz < SAMPLER_RATE_MIN_HZ || hz > SAMPLER_RATE_MAX_HZ) {
+		return -EINVAL;
+	}
+
+	rate_hz = hz;
+
+	/* Only re-arm the timer if sampling is already running */
+	if (running) {
+		sampler_arm();
+	}
+
+	return 0;
+}
+
+int sampler_start(uint32_t hz)
+{
+	int err;
+
+	err = sampler_set_rate(hz);
+	if (err) {
+		return err;
+	}
+
+	running = true;
+	sampler_arm();
+
+	LOG_INF("Sampling %d channels at %u Hz", SAMPLER_NUM_CHANNELS,
+		rate_hz);
+
+	return 0;
+}
+
+void sampler_stop(void)
+{
+	running = false;
+	k_timer_stop(&sample_timer);
+	k_sem_reset(&sample_sem);
+}
+
+int sampler_set_channels(uint8_t mask, const uint8_t *divisor)
+{
+	k_spinlock_key_t key;
+
+	if (mask & ~BIT_MASK(SAMPLER_NUM_CHANNELS)) {
+		return -EINVAL;
+	}
+
+	for (size_t i = 0U; i < ARRAY_SIZE(adc_channels); i++) {
+		if (divisor[i] == 0U) {
+			return -EINVAL;
+		}
+	}
+
+	key = k_spin_lock(&lock);
+	chan_mask = mask;
+	memcpy(chan_divisor, divisor, sizeof(chan_divisor));
+	k_spin_unlock(&lock, key);
+
+	LOG_INF("Channel mask 0x%02x", mask);
+
+	return 0;
+}
+
+void sampler_get_channels(uint8_t *mask, uint8_t *divisor)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*mask = chan_mask;
+	memcpy(divisor, chan_divisor, sizeof(chan_divisor));
+
+	k_spin_unlock(&lock, key);
+}
+
+int sampler_set_window(uint32_t scans)
+{
+	k_spinlock_key_t key;
+
+	if (scans == 0U) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&lock);
+	window = scans;
+	k_spin_unlock(&lock, key);
+
+	return 0;
+}
+
+bool sampler_is_running(void)
+{
+	return running;
+}
+
+uint32_t sampler_get_rate(void)
+{
+	return rate_hz;
+}
+
+void sampler_get_stats(struct sampler_stats *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*out = stats;
+
+	k_spin_unlock(&lock, key);
+}
+
+const struct adc_dt_spec *sampler_channel(size_t idx)
+{
+	if (idx >= ARRAY_SIZE(adc_channels)) {
+		return NULL;
+	}
+
+	return &adc_channels[idx];
+}
+
+int sampler_raw_to_mv(size_t idx, int32_t *val)
+{
+	const struct adc_dt_spec *spec = sampler_channel(idx);
+
+	if (!spec) {
+		return -EINVAL;
+	}
+
+	/*
+	 * If using differential mode, the 16 bit value
+	 * in the ADC sample buffer should be a signed 2's
+	 * complement value.
+	 */
+	if (!spec->channel_cfg.differential) {
+		*val = (uint16_t)*val;
+	}
+
+	return adc_raw_to_millivolts_dt(spec, val);
+}
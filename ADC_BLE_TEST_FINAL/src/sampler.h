@@ -0,0 +1,83 @@
+/** @file
+ *  @brief Timer driven multi-channel ADC sampler
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <zephyr/types.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of io-channels listed under the zephyr,user node */
+#define SAMPLER_NUM_CHANNELS DT_PROP_LEN(DT_PATH(zephyr_user), io_channels)
+
+#define SAMPLER_RATE_MIN_HZ 1U
+#define SAMPLER_RATE_MAX_HZ 10000U
+#define SAMPLER_DIVISOR_MAX UINT8_MAX
+
+/* One scan of every channel, in zephyr,user io-channels order */
+struct sampler_scan {
+	/* Index of the timer period the scan belongs to. Periods that
+	 * could not be converted (overrun or ADC error) leave a gap.
+	 */
+	uint32_t seq;
+	/* Kernel uptime in ticks at which the scan was due */
+	int64_t ticks;
+	/* Timer period in kernel ticks the scan was taken with */
+	uint32_t period_ticks;
+	/* Channels converted in this scan, raw[] is only valid for these */
+	uint8_t mask;
+	/* Rate divisor of every channel when the scan was taken */
+	uint8_t divisor[SAMPLER_NUM_CHANNELS];
+	int16_t raw[SAMPLER_NUM_CHANNELS];
+};
+
+struct sampler_stats {
+	uint32_t scans;
+	uint32_t overruns;
+	uint32_t errors;
+	/* Time between the starts of consecutive conversions */
+	uint32_t period_min_cyc;
+	uint32_t period_max_cyc;
+	/* Time from the timer expiry to the start of the conversion */
+	uint32_t latency_max_cyc;
+};
+
+/* Called from the sampler thread after every successful scan */
+typedef void (*sampler_cb_t)(const struct sampler_scan *scan);
+
+int sampler_init(sampler_cb_t cb);
+int sampler_start(uint32_t rate_hz);
+void sampler_stop(void);
+bool sampler_is_running(void);
+int sampler_set_rate(uint32_t rate_hz);
+uint32_t sampler_get_rate(void);
+void sampler_get_stats(struct sampler_stats *stats);
+
+/* Selects the channels to convert. Channel n is converted in every
+ * divisor[n]-th window of scans, see sampler_set_window(); disabled
+ * channels are left out of the ADC sequence altogether.
+ */
+int sampler_set_channels(uint8_t mask, const uint8_t *divisor);
+void sampler_get_channels(uint8_t *mask, uint8_t *divisor);
+
+/* Number of consecutive scans that always convert the same channels */
+int sampler_set_window(uint32_t scans);
+
+const struct adc_dt_spec *sampler_channel(size_t idx);
+int sampler_raw_to_mv(size_t idx, int32_t *val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLER_H_ */
@@ -0,0 +1,945 @@
+/** @file
+ *  @brief BLE sender draining the sample ring into GATT notifications
+ *
+ *  Runs in its own thread so that a slow or congested link only fills
+ *  the sample ring and never delays the sampler.
+ *
+ *  Channels sharing a rate divisor are framed together. Each such group
+ *  has its own frame in progress, numbered in samples of its own rate,
+ *  so a slow channel never splits the frames of a fast one.
+ *
+ *  In indicate mode every frame is kept in a small queue until the
+ *  client confirms it, and is resent if the indication fails. A frame
+ *  still unconfirmed after its last retry, e.g. when the link drops,
+ *  goes to the sample log like any frame the link did not take.
+ *
+ *  When a client has connected the L2CAP channel, frames go out as SDUs
+ *  of up to its MTU instead, paced by the credits the client grants.
+ *  Frames still open when the client changes the way they go out are
+ *  flushed; one built larger than the new way takes is split again.
+ *
+ *  With the periodic advertising train running, every live frame is
+ *  also queued for broadcast, whether or not a client is connected.
+ *  Frames are then built no larger than the train carries. Without a
+ *  client, only the frames the train could not take are logged.
+ *
+ *  While no client is subscribed, frames are built to a larger size and
+ *  written to the sample log instead. Once a client subscribes they are
+ *  replayed, split to the current MTU, whenever the sample ring is
+ *  empty, so live data always goes first.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#include "sampler.h"
+#include "sample_ring.h"
+#include "sample_frame.h"
+#include "stream.h"
+#include "sample_log.h"
+#include "cts.h"
+#include "coc.h"
+#include "link.h"
+#include "broadcast.h"
+
+LOG_MODULE_REGISTER(stream, CONFIG_APP_LOG_LEVEL);
+
+/* Notification payload is the ATT MTU minus opcode and handle */
+#define ATT_NOTIFY_HDR_LEN 3U
+#define PAYLOAD_MAX_LEN (CONFIG_BT_L2CAP_TX_MTU - ATT_NOTIFY_HDR_LEN)
+
+#if defined(CONFIG_APP_SAMPLE_LOG)
+#define LOG_FRAME_LEN CONFIG_APP_SAMPLE_LOG_FRAME_LEN
+#define LOG_FLUSH_MS CONFIG_APP_SAMPLE_LOG_FLUSH_MS
+#else
+#define LOG_FRAME_LEN 0
+#define LOG_FLUSH_MS 0
+#endif
+
+#if defined(CONFIG_APP_COC)
+#define COC_SDU_LEN CONFIG_APP_COC_SDU_LEN
+#else
+#define COC_SDU_LEN 0
+#endif
+
+#if defined(CONFIG_APP_BROADCAST)
+#define BROADCAST_LEN CONFIG_APP_BROADCAST_FRAME_LEN
+#else
+#define BROADCAST_LEN 0
+#endif
+
+#define LIVE_MAX_LEN MAX(MAX(PAYLOAD_MAX_LEN, COC_SDU_LEN), BROADCAST_LEN)
+#define FRAME_MAX_LEN MAX(LIVE_MAX_LEN, LOG_FRAME_LEN)
+
+BUILD_ASSERT(SAMPLER_NUM_CHANNELS <= SAMPLE_FRAME_MAX_CHANNELS);
+
+/* Frame in progress for the channels sharing one rate divisor */
+struct frame_group {
+	bool open;
+	uint8_t mask;
+	uint8_t divisor;
+	/* Clock offset and flags the frame was stamped with */
+	uint8_t flags;
+	int64_t epoch;
+	uint32_t period;
+	int64_t deadline;
+	struct sample_frame_enc enc;
+	uint8_t payload[FRAME_MAX_LEN];
+};
+
+static const struct bt_gatt_attr *stream_attr;
+/* At most one group per channel */
+static struct frame_group groups[SAMPLER_NUM_CHANNELS];
+
+/* Payload size for the next frame, follows the negotiated MTU */
+static atomic_t payload_len = ATOMIC_INIT(STREAM_DEFAULT_MTU -
+					  ATT_NOTIFY_HDR_LEN);
+/* SDU size of the L2CAP channel, 0 while frames go over GATT */
+static atomic_t coc_len;
+/* Counts changes of the way frames go out, open frames sized for the
+ * previous one are flushed by the sender
+ */
+static atomic_t transport_gen;
+
+static atomic_t scans;
+static atomic_t sent;
+static atomic_t tx_errors;
+static atomic_t dropped;
+static atomic_t bytes;
+static atomic_t stalls;
+
+/* CPU time spent per scan, waiting for credits or slots excluded */
+static struct k_spinlock cyc_lock;
+static uint64_t cyc_total;
+static uint32_t cyc_max;
+/* Time the current iteration spent blocked, sender thread only */
+static uint32_t wait_cyc;
+
+/* Takes sem, counting a stall and keeping the wait out of the budget */
+static void wait_for(struct k_sem *sem)
+{
+	uint32_t start;
+
+	if (k_sem_take(sem, K_NO_WAIT) == 0) {
+		return;
+	}
+
+	atomic_inc(&stalls);
+
+	start = k_cycle_get_32();
+	k_sem_take(sem, K_FOREVER);
+	wait_cyc += k_cycle_get_32() - start;
+}
+
+/* One credit per notification the stack may hold at a time. By default
+ * one ACL buffer stays free for command responses.
+ */
+#define TX_CREDITS (CONFIG_APP_STREAM_TX_CREDITS ?			\
+		    CONFIG_APP_STREAM_TX_CREDITS :			\
+		    CONFIG_BT_BUF_ACL_TX_COUNT - 1)
+BUILD_ASSERT(TX_CREDITS > 0);
+static K_SEM_DEFINE(tx_credits, TX_CREDITS, TX_CREDITS);
+
+static atomic_t mode = ATOMIC_INIT(STREAM_MODE_OFF);
+
+#define IND_DEPTH CONFIG_APP_STREAM_INDICATE_DEPTH
+#define IND_RETRY_DELAY K_MSEC(10)
+#define REPLAY_RETRY_MS 10
+
+struct ind_slot {
+	struct bt_gatt_indicate_params params;
+	uint8_t data[PAYLOAD_MAX_LEN];
+	uint8_t samples;
+	uint8_t retries;
+	uint8_t err;
+};
+
+static struct ind_slot ind_slots[IND_DEPTH];
+static K_SEM_DEFINE(ind_free, IND_DEPTH, IND_DEPTH);
+static ATOMIC_DEFINE(ind_busy, IND_DEPTH);
+static ATOMIC_DEFINE(ind_retry, IND_DEPTH);
+/* Out of retries, waiting to be written to the sample log */
+static ATOMIC_DEFINE(ind_lost, IND_DEPTH);
+
+static atomic_t confirmed;
+static atomic_t retries;
+
+static void ind_retry_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(ind_retry_work, ind_retry_handler);
+
+static int log_frame(uint8_t *data, size_t len);
+static int replay(const uint8_t *frame, size_t len);
+
+static void ind_release(struct ind_slot *slot)
+{
+	atomic_clear_bit(ind_busy, ARRAY_INDEX(ind_slots, slot));
+	k_sem_give(&ind_free);
+}
+
+/* Schedules a resend, or the frame's move to the sample log once the
+ * retries are spent. Both happen on the work queue, the flash write
+ * must not hold up the Bluetooth thread this may be called from.
+ */
+static void ind_failed(struct ind_slot *slot)
+{
+	if (slot->retries < CONFIG_APP_STREAM_INDICATE_RETRIES) {
+		slot->retries++;
+		atomic_inc(&retries);
+		atomic_set_bit(ind_retry, ARRAY_INDEX(ind_slots, slot));
+		k_work_reschedule(&ind_retry_work, IND_RETRY_DELAY);
+		return;
+	}
+
+	atomic_set_bit(ind_lost, ARRAY_INDEX(ind_slots, slot));
+	k_work_schedule(&ind_retry_work, K_NO_WAIT);
+}
+
+/* Keeps an unconfirmed frame for replay, the client may have seen it
+ * already and then gets it twice
+ */
+static void ind_keep(struct ind_slot *slot)
+{
+	if (log_frame(slot->data, slot->params.len) != 0) {
+		atomic_inc(&tx_errors);
+		atomic_add(&dropped, slot->samples);
+	}
+
+	ind_release(slot);
+}
+
+static void ind_submit(struct ind_slot *slot)
+{
+	slot->err = 0U;
+
+	if (bt_gatt_indicate(NULL, &slot->params) != 0) {
+		ind_failed(slot);
+	}
+}
+
+static void ind_retry_handler(struct k_work *work)
+{
+	for (size_t i = 0U; i < IND_DEPTH; i++) {
+		if (atomic_test_and_clear_bit(ind_lost, i)) {
+			ind_keep(&ind_slots[i]);
+		} else if (atomic_test_and_clear_bit(ind_retry, i)) {
+			ind_submit(&ind_slots[i]);
+		}
+	}
+}
+
+static void indicate_cb(struct bt_conn *conn,
+			struct bt_gatt_indicate_params *params, uint8_t err)
+{
+	struct ind_slot *slot = CONTAINER_OF(params, struct ind_slot, params);
+
+	slot->err = err;
+}
+
+/* Called once the stack no longer references the parameters */
+static void indicate_destroy(struct bt_gatt_indicate_params *params)
+{
+	struct ind_slot *slot = CONTAINER_OF(params, struct ind_slot, params);
+
+	if (slot->err) {
+		ind_failed(slot);
+		return;
+	}
+
+	atomic_inc(&confirmed);
+	ind_release(slot);
+}
+
+/* Queues a copy of the frame, waiting while every slot is outstanding.
+ * Returns -EMSGSIZE for a frame sized for another transport.
+ */
+static int indicate_frame(const uint8_t *data, uint16_t len, uint8_t samples)
+{
+	struct ind_slot *slot = NULL;
+
+	if (len > PAYLOAD_MAX_LEN) {
+		return -EMSGSIZE;
+	}
+
+	wait_for(&ind_free);
+
+	for (size_t i = 0U; i < IND_DEPTH; i++) {
+		if (!atomic_test_and_set_bit(ind_busy, i)) {
+			slot = &ind_slots[i];
+			break;
+		}
+	}
+
+	__ASSERT_NO_MSG(slot);
+	__ASSERT(len <= sizeof(slot->data), "frame of %u bytes", len);
+
+	memcpy(slot->data, data, len);
+	slot->samples = samples;
+	slot->retries = 0U;
+	slot->params = (struct bt_gatt_indicate_params) {
+		.attr = stream_attr,
+		.func = indicate_cb,
+		.destroy = indicate_destroy,
+		.data = slot->data,
+		.len = len,
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_DATA),
+#endif
+	};
+
+	atomic_inc(&sent);
+	atomic_add(&bytes, len);
+
+	ind_submit(slot);
+
+	return 0;
+}
+
+/* Per-sample diagnostics are compiled out unless an interval is set */
+static void log_scan(const struct sampler_scan *scan)
+{
+	if (CONFIG_APP_LOG_SAMPLE_INTERVAL == 0 ||
+	    (scan->seq % CONFIG_APP_LOG_SAMPLE_INTERVAL) != 0U) {
+		return;
+	}
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		const struct adc_dt_spec *spec = sampler_channel(i);
+		int32_t val_mv = scan->raw[i];
+
+		if (!(scan->mask & BIT(i))) {
+			continue;
+		}
+
+		/* conversion to mV may not be supported, -1 if not */
+		if (sampler_raw_to_mv(i, &val_mv) < 0) {
+			val_mv = -1;
+		}
+
+		LOG_INF("ADC reading[%u] %s, channel %d: %d = %d mV",
+			scan->seq, spec->dev->name, spec->channel_id,
+			scan->raw[i], val_mv);
+	}
+}
+
+/* Runs in the BT TX context once the notification reached the controller */
+static void notify_done(struct bt_conn *conn, void *user_data)
+{
+	k_sem_give(&tx_credits);
+}
+
+static int send_frame(const uint8_t *data, uint16_t len)
+{
+	struct bt_gatt_notify_params params = {
+		.attr = stream_attr,
+		.data = data,
+		.len = len,
+		.func = notify_done,
+#if defined(CONFIG_BT_EATT)
+		.chan_opt = link_bearer(LINK_TRAFFIC_DATA),
+#endif
+	};
+	uint32_t start;
+	int err;
+
+	/* Wait for the controller queue to drain. The producer keeps
+	 * running meanwhile, a long stall only fills the sample ring.
+	 */
+	wait_for(&tx_credits);
+
+	for (int retry = 0; ; retry++) {
+		err = bt_gatt_notify_cb(NULL, &params);
+		if (err != -ENOMEM || retry == CONFIG_APP_STREAM_TX_RETRIES) {
+			break;
+		}
+
+		/* Buffers are shared with other traffic, back off briefly */
+		start = k_cycle_get_32();
+		k_sleep(K_MSEC(1));
+		wait_cyc += k_cycle_get_32() - start;
+	}
+
+	/* The callback never fires for a refused notification */
+	if (err) {
+		k_sem_give(&tx_credits);
+	}
+
+	return err;
+}
+
+static int send_sdu(const uint8_t *data, uint16_t len)
+{
+	uint32_t start;
+	int err;
+
+	err = coc_send(data, len, K_NO_WAIT);
+	if (err != -ENOBUFS) {
+		return err;
+	}
+
+	/* Every buffer waits for credits of the client, a long stall only
+	 * fills the sample ring
+	 */
+	atomic_inc(&stalls);
+
+	start = k_cycle_get_32();
+	err = coc_send(data, len, K_FOREVER);
+	wait_cyc += k_cycle_get_32() - start;
+
+	return err;
+}
+
+/* A client takes frames over GATT or the L2CAP channel */
+static bool streaming(void)
+{
+	return atomic_get(&coc_len) != 0 ||
+	       atomic_get(&mode) != STREAM_MODE_OFF;
+}
+
+/* The periodic advertising train takes every live frame */
+static bool broadcasting(void)
+{
+	return IS_ENABLED(CONFIG_APP_BROADCAST) && broadcast_active();
+}
+
+/* Size of the next live frame */
+static size_t live_len(void)
+{
+	size_t len = atomic_get(&coc_len);
+
+	if (!len) {
+		len = atomic_get(&payload_len);
+	}
+
+	if (broadcasting()) {
+		len = streaming() ? MIN(len, BROADCAST_LEN) : BROADCAST_LEN;
+	}
+
+	return len;
+}
+
+/* Hands a frame to the stack in the current delivery mode. Returns
+ * -EMSGSIZE if the frame was built for a transport taking larger ones.
+ */
+static int transmit(const uint8_t *data, uint16_t len, uint8_t samples)
+{
+	enum stream_mode cur = atomic_get(&mode);
+	int err;
+
+	if (IS_ENABLED(CONFIG_APP_COC) && atomic_get(&coc_len) != 0) {
+		if (len > atomic_get(&coc_len)) {
+			return -EMSGSIZE;
+		}
+
+		err = send_sdu(data, len);
+	} else if (cur == STREAM_MODE_OFF) {
+		return -ENOTCONN;
+	} else if (len > atomic_get(&payload_len)) {
+		return -EMSGSIZE;
+	} else if (cur == STREAM_MODE_INDICATE) {
+		/* Reliable mode tracks every frame until it is confirmed */
+		return indicate_frame(data, len, samples);
+	} else {
+		/* Notify connected devices of the new samples */
+		err = send_frame(data, len);
+	}
+
+	if (err) {
+		return err;
+	}
+
+	atomic_inc(&sent);
+	atomic_add(&bytes, len);
+
+	return 0;
+}
+
+/* Marks the frame for late delivery and stores it in the sample log */
+static int log_frame(uint8_t *data, size_t len)
+{
+	int err;
+
+	if (!IS_ENABLED(CONFIG_APP_SAMPLE_LOG)) {
+		return -ENOTSUP;
+	}
+
+	data[0] |= SAMPLE_FRAME_FLAG_BACKFILL;
+
+	err = sample_log_append(data, len);
+	if (err) {
+		LOG_ERR("Sample log append failed (err %d)", err);
+	}
+
+	return err;
+}
+
+static void flush_frame(struct frame_group *grp)
+{
+	bool aired;
+	size_t len;
+	int err;
+
+	if (!grp->open) {
+		return;
+	}
+
+	grp->open = false;
+
+	len = sample_frame_len(&grp->enc);
+
+	if (grp->flags & SAMPLE_FRAME_FLAG_BACKFILL) {
+		err = log_frame(grp->payload, len);
+	} else {
+		/* Ahead of log_frame(), which flags the frame as backfill */
+		aired = broadcasting() &&
+			broadcast_send(grp->payload, len) == 0;
+
+		err = transmit(grp->payload, len, grp->enc.count);
+
+		/* Built before the transport changed, sent again in parts */
+		if (err == -EMSGSIZE) {
+			err = replay(grp->payload, len);
+		}
+
+		/* Without a client the train is the only destination */
+		if (err == -ENOTCONN && aired) {
+			err = 0;
+		}
+
+		/* A frame the link did not take is kept for later, too */
+		if (err && log_frame(grp->payload, len) == 0) {
+			err = 0;
+		}
+	}
+
+	if (err) {
+		atomic_inc(&tx_errors);
+		atomic_add(&dropped, grp->enc.count);
+	}
+}
+
+/* Starts a frame holding values as its first sample. A delta frame
+ * spends a byte on the sample count, so at the smallest payloads the
+ * first sample of every channel only fits a plain frame. Returns the
+ * encoder's error, e.g. -ERANGE for a timestamp beyond the header.
+ */
+static int begin_frame(struct sample_frame_enc *enc, uint8_t *buf,
+		       size_t size, uint8_t mask, uint8_t flags, uint32_t seq,
+		       uint64_t ticks, uint32_t period, const int16_t *values)
+{
+	int err;
+
+	err = sample_frame_begin(enc, buf, size, mask, flags, seq, ticks,
+				 period);
+	if (err) {
+		return err;
+	}
+
+	if (sample_frame_add(enc, seq, values) == 0) {
+		return 0;
+	}
+
+	err = sample_frame_begin(enc, buf, size, mask,
+				 flags & ~SAMPLE_FRAME_FLAG_DELTA, seq, ticks,
+				 period);
+	if (err) {
+		return err;
+	}
+
+	return sample_frame_add(enc, seq, values);
+}
+
+/* Finds the group of a divisor, claiming an idle one if needed */
+static struct frame_group *find_group(uint8_t divisor)
+{
+	struct frame_group *idle = NULL;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(groups); i++) {
+		if (groups[i].open && groups[i].divisor == divisor) {
+			return &groups[i];
+		}
+
+		if (!groups[i].open && !idle) {
+			idle = &groups[i];
+		}
+	}
+
+	/* There are never more open groups than channels */
+	__ASSERT_NO_MSG(idle);
+	idle->divisor = divisor;
+
+	return idle;
+}
+
+static void add_samples(struct frame_group *grp,
+			const struct sampler_scan *scan, uint8_t mask,
+			int64_t epoch, uint8_t flags)
+{
+	/* Samples of the group are numbered at the group's own rate */
+	uint32_t seq = scan->seq / grp->divisor;
+	uint32_t period = scan->period_ticks * grp->divisor;
+
+	/* A rate, channel or clock change, a sequence gap or a full
+	 * payload closes the frame
+	 */
+	if (grp->open && (period != grp->period || mask != grp->mask ||
+			  epoch != grp->epoch || flags != grp->flags ||
+			  sample_frame_add(&grp->enc, seq, scan->raw) != 0)) {
+		flush_frame(grp);
+	}
+
+	if (!grp->open) {
+		bool logged = flags & SAMPLE_FRAME_FLAG_BACKFILL;
+
+		/* Logged frames are not waited for, only their size counts */
+		if (begin_frame(&grp->enc, grp->payload,
+				logged ? LOG_FRAME_LEN : live_len(),
+				mask, flags, seq, scan->ticks + epoch, period,
+				scan->raw) != 0) {
+			/* E.g. a timestamp the header cannot carry, the
+			 * group stays closed and the sample is lost
+			 */
+			atomic_inc(&dropped);
+			return;
+		}
+
+		grp->open = true;
+		grp->mask = mask;
+		grp->period = period;
+		grp->epoch = epoch;
+		grp->flags = flags;
+		grp->deadline = scan->ticks +
+			k_ms_to_ticks_ceil64(logged ? LOG_FLUSH_MS :
+					     CONFIG_APP_STREAM_MAX_LATENCY_MS);
+	}
+
+	if (sample_frame_full(&grp->enc)) {
+		flush_frame(grp);
+	}
+}
+
+static void add_scan(const struct sampler_scan *scan)
+{
+	int64_t epoch = 0;
+	uint8_t flags = IS_ENABLED(CONFIG_APP_STREAM_COMPRESS) ?
+			SAMPLE_FRAME_FLAG_DELTA : 0U;
+	uint8_t left = scan->mask;
+
+	log_scan(scan);
+
+	/* Stamp against the wall clock once a client has set it */
+	if (cts_epoch_offset(&epoch) == 0) {
+		flags |= SAMPLE_FRAME_FLAG_EPOCH;
+	}
+
+	/* Nobody listens, build frames for the sample log */
+	if (IS_ENABLED(CONFIG_APP_SAMPLE_LOG) && !streaming() &&
+	    !broadcasting()) {
+		flags |= SAMPLE_FRAME_FLAG_BACKFILL;
+	}
+
+	/* One frame group per distinct divisor among the scanned channels */
+	while (left) {
+		uint8_t divisor = scan->divisor[find_lsb_set(left) - 1];
+		uint8_t mask = 0U;
+
+		for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+			if ((left & BIT(i)) && scan->divisor[i] == divisor) {
+				mask |= BIT(i);
+			}
+		}
+
+		left &= ~mask;
+		add_samples(find_group(divisor), scan, mask, epoch, flags);
+	}
+}
+
+/* Sends the open frames at once, e.g. after the transport changed */
+static void flush_all(void)
+{
+	for (size_t i = 0U; i < ARRAY_SIZE(groups); i++) {
+		flush_frame(&groups[i]);
+	}
+}
+
+/* Sends every frame whose first sample has waited long enough */
+static void flush_expired(void)
+{
+	int64_t now = k_uptime_ticks();
+
+	for (size_t i = 0U; i < ARRAY_SIZE(groups); i++) {
+		if (groups[i].open && groups[i].deadline <= now) {
+			flush_frame(&groups[i]);
+		}
+	}
+}
+
+/* How long the sender may wait for the next scan before flushing, or
+ * at most until deadline (INT64_MAX for none)
+ */
+static k_timeout_t frame_timeout(int64_t deadline)
+{
+	int64_t left;
+
+	for (size_t i = 0U; i < ARRAY_SIZE(groups); i++) {
+		if (groups[i].open) {
+			deadline = MIN(deadline, groups[i].deadline);
+		}
+	}
+
+	if (deadline == INT64_MAX) {
+		return K_FOREVER;
+	}
+
+	left = deadline - k_uptime_ticks();
+
+	return K_TICKS(MAX(left, 0));
+}
+
+/* Sends a logged frame, split into frames of the current payload size
+ * if it is larger. Samples logged before the clock was set are stamped
+ * against it now. Fails as a whole if any part is refused, the frame
+ * is then sent again later and the parts already out are duplicated.
+ */
+static int replay(const uint8_t *frame, size_t len)
+{
+	static uint16_t values[SAMPLE_FRAME_MAX_SAMPLES * SAMPLER_NUM_CHANNELS];
+	static uint8_t chunk[LIVE_MAX_LEN];
+	size_t size = live_len();
+	struct sample_frame_hdr hdr;
+	struct sample_frame_enc enc;
+	int16_t raw[SAMPLE_FRAME_MAX_CHANNELS];
+	bool open = false;
+	int64_t epoch;
+	int count;
+	int err;
+
+	count = sample_frame_decode(frame, len, &hdr, values,
+				    ARRAY_SIZE(values));
+	if (count <= 0) {
+		/* A corrupted entry, it is dropped */
+		return 0;
+	}
+
+	if (!(hdr.flags & SAMPLE_FRAME_FLAG_EPOCH) &&
+	    cts_epoch_offset(&epoch) == 0) {
+		hdr.ticks += epoch;
+		hdr.flags |= SAMPLE_FRAME_FLAG_EPOCH;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const uint16_t *row = &values[i * popcount(hdr.mask)];
+		uint32_t seq = hdr.seq + i;
+		size_t n = 0U;
+
+		for (size_t ch = 0U; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+			if (hdr.mask & BIT(ch)) {
+				raw[ch] = row[n++];
+			}
+		}
+
+		if (open && sample_frame_add(&enc, seq, raw) == 0) {
+			continue;
+		}
+
+		if (open) {
+			err = transmit(chunk, sample_frame_len(&enc),
+				       enc.count);
+			if (err) {
+				return err;
+			}
+		}
+
+		open = begin_frame(&enc, chunk, size, hdr.mask, hdr.flags,
+				   seq, hdr.ticks + (uint64_t)i * hdr.period,
+				   hdr.period, raw) == 0;
+		if (!open) {
+			atomic_inc(&dropped);
+		}
+	}
+
+	return open ? transmit(chunk, sample_frame_len(&enc), enc.count) : 0;
+}
+
+/* Sends the oldest logged frame once a client is back. Returns false
+ * if the link refused it, it is then tried again later.
+ */
+static bool replay_next(void)
+{
+	static uint8_t frame[MAX(LOG_FRAME_LEN, 1)];
+	int len;
+
+	len = sample_log_peek(frame, sizeof(frame));
+	if (len < 0) {
+		LOG_ERR("Sample log read failed (err %d)", len);
+		sample_log_pop();
+		return true;
+	}
+
+	if (len > 0 && replay(frame, len) != 0) {
+		return false;
+	}
+
+	if (len > 0) {
+		sample_log_pop();
+	}
+
+	return true;
+}
+
+static bool replay_due(void)
+{
+	return IS_ENABLED(CONFIG_APP_SAMPLE_LOG) && streaming() &&
+	       !sample_log_empty() && !sample_log_held();
+}
+
+static void account_cycles(uint32_t cyc)
+{
+	k_spinlock_key_t key = k_spin_lock(&cyc_lock);
+
+	cyc_total += cyc;
+	cyc_max = MAX(cyc_max, cyc);
+
+	k_spin_unlock(&cyc_lock, key);
+}
+
+static void stream_thread(void *p1, void *p2, void *p3)
+{
+	struct sampler_scan *scan;
+	uint32_t start_cyc;
+	int64_t retry_at = 0;
+	atomic_val_t gen = 0;
+
+	ARG_UNUSED(p1);
+	ARG_UNUSED(p2);
+	ARG_UNUSED(p3);
+
+	while (1) {
+		bool backfill = replay_due() && k_uptime_ticks() >= retry_at;
+
+		/* The log is replayed whenever no live scan is waiting. A
+		 * refused replay backs off, so a link that keeps refusing
+		 * does not turn this into a busy loop.
+		 */
+		scan = sample_ring_get_claim(backfill ? K_NO_WAIT :
+			frame_timeout(replay_due() ? retry_at : INT64_MAX));
+
+		/* No frame goes out at a size chosen for another transport */
+		if (atomic_get(&transport_gen) != gen) {
+			gen = atomic_get(&transport_gen);
+			flush_all();
+		}
+
+		if (!scan) {
+			flush_expired();
+			if (backfill && !replay_next()) {
+				retry_at = k_uptime_ticks() +
+					   k_ms_to_ticks_ceil64(REPLAY_RETRY_MS);
+			}
+			continue;
+		}
+
+		start_cyc = k_cycle_get_32();
+		wait_cyc = 0U;
+
+		atomic_inc(&scans);
+		add_scan(scan);
+
+		sample_ring_get_finish();
+
+		account_cycles(k_cycle_get_32() - start_cyc - wait_cyc);
+	}
+}
+
+/* Started from stream_init() once the characteristic is known */
+K_THREAD_DEFINE(stream_tid, CONFIG_APP_STREAM_STACK_SIZE, stream_thread,
+		NULL, NULL, NULL, CONFIG_APP_STREAM_PRIORITY, 0,
+		SYS_FOREVER_MS);
+
+void stream_init(const struct bt_gatt_attr *attr)
+{
+	stream_attr = attr;
+	k_thread_start(stream_tid);
+}
+
+void stream_set_mode(enum stream_mode new_mode)
+{
+	if (atomic_set(&mode, new_mode) != new_mode) {
+		atomic_inc(&transport_gen);
+	}
+}
+
+enum stream_mode stream_get_mode(void)
+{
+	return atomic_get(&mode);
+}
+
+void stream_set_mtu(uint16_t mtu)
+{
+	uint16_t len = MAX(mtu, STREAM_DEFAULT_MTU) - ATT_NOTIFY_HDR_LEN;
+
+	atomic_set(&payload_len, MIN(len, PAYLOAD_MAX_LEN));
+}
+
+void stream_set_coc(uint16_t sdu_len)
+{
+	atomic_val_t len = MIN(sdu_len, LIVE_MAX_LEN);
+
+	/* Frames open for the channel are too large for GATT once it is
+	 * gone, and the other way round
+	 */
+	if (atomic_set(&coc_len, len) != len) {
+		atomic_inc(&transport_gen);
+	}
+}
+
+bool stream_coc_active(void)
+{
+	return atomic_get(&coc_len) != 0;
+}
+
+void stream_disconnected(void)
+{
+	stream_set_mtu(STREAM_DEFAULT_MTU);
+
+	/* Completions of notifications still queued at disconnect may never
+	 * arrive. The semaphore limit keeps late ones from adding credits.
+	 */
+	for (int i = 0; i < TX_CREDITS; i++) {
+		k_sem_give(&tx_credits);
+	}
+}
+
+void stream_get_stats(struct stream_stats *stats)
+{
+	k_spinlock_key_t key;
+
+	stats->scans = atomic_get(&scans);
+	stats->sent = atomic_get(&sent);
+	stats->tx_errors = atomic_get(&tx_errors);
+	stats->dropped = atomic_get(&dropped);
+	stats->bytes = atomic_get(&bytes);
+	stats->stalls = atomic_get(&stalls);
+	stats->in_flight = TX_CREDITS - k_sem_count_get(&tx_credits);
+	stats->confirmed = atomic_get(&confirmed);
+	stats->retries = atomic_get(&retries);
+	stats->pending = IND_DEPTH - k_sem_count_get(&ind_free);
+
+	key = k_spin_lock(&cyc_lock);
+	stats->cyc_max = cyc_max;
+	stats->cyc_avg = stats->scans ? (uint32_t)(cyc_total / stats->scans) : 0U;
+	k_spin_unlock(&cyc_lock, key);
+}
@@ -0,0 +1,83 @@
+/** @file
+ *  @brief BLE sender draining the sample ring into GATT notifications
+ *
+ *  Frames go over the L2CAP channel instead while one is connected.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <zephyr/types.h>
+#include <zephyr/bluetooth/gatt.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ATT MTU every LE connection starts with */
+#define STREAM_DEFAULT_MTU 23U
+
+enum stream_mode {
+	/* No client subscribed, frames go to the sample log if enabled */
+	STREAM_MODE_OFF,
+	/* Notifications, paced by TX credits, lost if the link drops them */
+	STREAM_MODE_NOTIFY,
+	/* Indications, every frame resent until the client confirms it */
+	STREAM_MODE_INDICATE,
+};
+
+struct stream_stats {
+	/* Scans taken out of the sample ring */
+	uint32_t scans;
+	/* Frames accepted by the stack */
+	uint32_t sent;
+	/* Frames the stack refused, or indications that ran out of retries */
+	uint32_t tx_errors;
+	/* Samples lost with those frames */
+	uint32_t dropped;
+	/* Payload bytes accepted by the stack */
+	uint32_t bytes;
+	/* Times the sender had to wait for a TX credit or indication slot */
+	uint32_t stalls;
+	/* Notifications handed to the stack and not yet sent */
+	uint32_t in_flight;
+	/* Indications confirmed by the client */
+	uint32_t confirmed;
+	/* Indications resent after a failure */
+	uint32_t retries;
+	/* Indications waiting for confirmation or a retry */
+	uint32_t pending;
+	/* CPU cycles the sender spends per scan, blocking waits excluded */
+	uint32_t cyc_avg;
+	uint32_t cyc_max;
+};
+
+/* Starts the sender thread, notifying on the given characteristic */
+void stream_init(const struct bt_gatt_attr *attr);
+void stream_set_mode(enum stream_mode mode);
+enum stream_mode stream_get_mode(void);
+
+/* Sizes the following frames to the ATT MTU of the connection */
+void stream_set_mtu(uint16_t mtu);
+
+/* Sends the following frames over the L2CAP channel, as SDUs of up to
+ * sdu_len bytes. 0 goes back to the GATT mode.
+ */
+void stream_set_coc(uint16_t sdu_len);
+
+/* True while frames go over the L2CAP channel */
+bool stream_coc_active(void);
+
+/* Returns every TX credit and the default MTU once the link is gone */
+void stream_disconnected(void);
+void stream_get_stats(struct stream_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STREAM_H_ */
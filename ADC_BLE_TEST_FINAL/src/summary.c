@@ -0,0 +1,127 @@
+/** @file
+ *  @brief Live summary for the advertising data
+ *
+ *  The sampler thread only copies the raw values of every scan here.
+ *  Conversion to millivolts, the alarm check and the state are done
+ *  when a summary is encoded, once per advertising data update.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+#include "summary.h"
+#include "stream.h"
+#include "sample_log.h"
+#include "broadcast.h"
+
+static struct k_spinlock lock;
+static int16_t latest[SAMPLER_NUM_CHANNELS];
+/* Channels with a value in latest[] */
+static uint8_t seen;
+
+static atomic_t alert;
+static uint8_t counter;
+
+void summary_feed(const struct sampler_scan *scan)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		if (scan->mask & BIT(i)) {
+			latest[i] = scan->raw[i];
+		}
+	}
+
+	seen |= scan->mask;
+
+	k_spin_unlock(&lock, key);
+}
+
+void summary_set_alert(bool on)
+{
+	atomic_set(&alert, on);
+}
+
+static uint8_t stream_state(void)
+{
+	if (IS_ENABLED(CONFIG_APP_COC) && stream_coc_active()) {
+		return SUMMARY_STATE_STREAM_COC;
+	}
+
+	switch (stream_get_mode()) {
+	case STREAM_MODE_NOTIFY:
+		return SUMMARY_STATE_STREAM_NOTIFY;
+	case STREAM_MODE_INDICATE:
+		return SUMMARY_STATE_STREAM_INDICATE;
+	default:
+		return SUMMARY_STATE_STREAM_OFF;
+	}
+}
+
+void summary_encode(uint8_t *buf)
+{
+	int16_t raw[SAMPLER_NUM_CHANNELS];
+	uint8_t divisor[SAMPLER_NUM_CHANNELS];
+	uint8_t enabled;
+	uint8_t state;
+	uint8_t valid;
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&lock);
+	memcpy(raw, latest, sizeof(raw));
+	valid = seen;
+	k_spin_unlock(&lock, key);
+
+	/* A channel switched off keeps no stale value */
+	sampler_get_channels(&enabled, divisor);
+	valid &= enabled;
+
+	state = stream_state();
+
+	if (sampler_is_running()) {
+		state |= SUMMARY_STATE_SAMPLING;
+	}
+
+	if (IS_ENABLED(CONFIG_APP_BROADCAST) && broadcast_active()) {
+		state |= SUMMARY_STATE_BROADCAST;
+	}
+
+	if (IS_ENABLED(CONFIG_APP_SAMPLE_LOG) && !sample_log_empty()) {
+		state |= SUMMARY_STATE_BACKLOG;
+	}
+
+	if (atomic_get(&alert)) {
+		state |= SUMMARY_STATE_ALARM;
+	}
+
+	for (size_t i = 0U; i < SAMPLER_NUM_CHANNELS; i++) {
+		int32_t mv = raw[i];
+		int16_t out = SUMMARY_NO_VALUE;
+
+		if ((valid & BIT(i)) && sampler_raw_to_mv(i, &mv) == 0) {
+			out = CLAMP(mv, INT16_MIN + 1, INT16_MAX);
+
+			/* 0 leaves the level check off */
+			if (CONFIG_APP_SUMMARY_ALARM_MV != 0 &&
+			    mv >= CONFIG_APP_SUMMARY_ALARM_MV) {
+				state |= SUMMARY_STATE_ALARM;
+			}
+		}
+
+		sys_put_le16((uint16_t)out, &buf[SUMMARY_HDR_LEN + 2U * i]);
+	}
+
+	sys_put_le16(CONFIG_APP_COMPANY_ID, &buf[0]);
+	buf[2] = state;
+	buf[3] = SUMMARY_BATTERY_UNKNOWN;
+	buf[4] = counter++;
+}
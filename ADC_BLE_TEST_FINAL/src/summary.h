@@ -0,0 +1,69 @@
+/** @file
+ *  @brief Live summary for the advertising data
+ *
+ *  A monitor that only scans passively sees the device's state in the
+ *  manufacturer specific data of its advertisements, little endian:
+ *
+ *    u16 company identifier (CONFIG_APP_COMPANY_ID)
+ *    u8  state, SUMMARY_STATE_*
+ *    u8  battery level in percent, SUMMARY_BATTERY_UNKNOWN
+ *    u8  counter, +1 on every update
+ *    s16 latest value of every channel in mV, SUMMARY_NO_VALUE for
+ *        channels that are disabled or have no value yet
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef SUMMARY_H_
+#define SUMMARY_H_
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sampler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bits 0-1 of the state, how live frames leave the device */
+#define SUMMARY_STATE_STREAM_MASK 0x03U
+#define SUMMARY_STATE_STREAM_OFF 0x00U
+#define SUMMARY_STATE_STREAM_NOTIFY 0x01U
+#define SUMMARY_STATE_STREAM_INDICATE 0x02U
+#define SUMMARY_STATE_STREAM_COC 0x03U
+/* The sampler is running */
+#define SUMMARY_STATE_SAMPLING 0x04U
+/* The periodic advertising train carries the frames */
+#define SUMMARY_STATE_BROADCAST 0x08U
+/* Logged frames wait for a client */
+#define SUMMARY_STATE_BACKLOG 0x10U
+/* An alert level is set or a channel is at or above the alarm level */
+#define SUMMARY_STATE_ALARM 0x80U
+
+#define SUMMARY_NO_VALUE INT16_MIN
+/* Nothing measures the supply, the Battery Service level is a default */
+#define SUMMARY_BATTERY_UNKNOWN 0xFFU
+
+#define SUMMARY_HDR_LEN 5U
+#define SUMMARY_LEN (SUMMARY_HDR_LEN + 2U * SAMPLER_NUM_CHANNELS)
+
+/* Keeps the latest value of every channel, called from the sampler
+ * thread for every scan
+ */
+void summary_feed(const struct sampler_scan *scan);
+
+/* Raises or clears the alarm of an Immediate Alert level */
+void summary_set_alert(bool on);
+
+/* Writes the next summary to buf, which holds SUMMARY_LEN bytes */
+void summary_encode(uint8_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SUMMARY_H_ */
@@ -0,0 +1,263 @@
+/** @file
+ *  @brief Sample frame encoder and decoder tests
+ *
+ *  Frames are encoded, decoded again and compared, then cut short or
+ *  damaged to check that the decoder refuses them instead of reading
+ *  past the payload.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/ztest.h>
+#include <errno.h>
+#include <string.h>
+
+#include "sample_frame.h"
+
+#define BUF_LEN 64U
+#define MAX_VALUES (SAMPLE_FRAME_MAX_SAMPLES * SAMPLE_FRAME_MAX_CHANNELS)
+#define NUM_CHANNELS ((int)SAMPLE_FRAME_MAX_CHANNELS)
+/* Plain samples of three 12-bit channels, packed without padding */
+#define PLAIN_SAMPLES ((int)((BUF_LEN - SAMPLE_FRAME_HDR_LEN) * 8U / 36U))
+
+static uint8_t buf[BUF_LEN];
+static uint16_t out[MAX_VALUES];
+
+/* Fills the frame with samples of value(i, ch) until it is full.
+ * Returns the number of samples added.
+ */
+static int fill(struct sample_frame_enc *enc, uint32_t seq,
+		int16_t (*value)(int i, int ch))
+{
+	int16_t values[SAMPLE_FRAME_MAX_CHANNELS];
+	int i;
+
+	for (i = 0; !sample_frame_full(enc); i++) {
+		for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+			values[ch] = value(i, ch);
+		}
+
+		if (sample_frame_add(enc, seq + i, values) != 0) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/* Checks the decoded samples of the channels in mask against value() */
+static void check_values(int count, uint8_t mask,
+			 int16_t (*value)(int i, int ch))
+{
+	const uint16_t *v = out;
+
+	for (int i = 0; i < count; i++) {
+		for (int ch = 0; ch < NUM_CHANNELS; ch++) {
+			if (mask & BIT(ch)) {
+				zassert_equal(*v++, value(i, ch),
+					      "sample %d channel %d", i, ch);
+			}
+		}
+	}
+}
+
+static int16_t ramp(int i, int ch)
+{
+	return (int16_t)(1000 + 100 * ch + 3 * i);
+}
+
+/* Full scale swings, every delta beyond the Rice escape */
+static int16_t square(int i, int ch)
+{
+	return ((i + ch) & 1) ? SAMPLE_FRAME_VALUE_MAX : 0;
+}
+
+static void encode(uint8_t mask, uint8_t flags,
+		   int16_t (*value)(int i, int ch), int *count, size_t *len)
+{
+	struct sample_frame_enc enc;
+
+	zassert_ok(sample_frame_begin(&enc, buf, sizeof(buf), mask, flags,
+				      0xfffeU, 0x123456789abcdeULL,
+				      SAMPLE_FRAME_PERIOD_MAX));
+
+	*count = fill(&enc, 0xfffeU, value);
+	*len = sample_frame_len(&enc);
+
+	zassert_true(*count > 1, "only %d samples", *count);
+	zassert_true(*len <= sizeof(buf));
+}
+
+ZTEST(sample_frame, test_plain_round_trip)
+{
+	struct sample_frame_hdr hdr;
+	size_t len;
+	int count;
+
+	encode(0x0bU, SAMPLE_FRAME_FLAG_EPOCH, ramp, &count, &len);
+
+	zassert_equal(count, PLAIN_SAMPLES);
+
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, MAX_VALUES),
+		      count);
+	zassert_equal(hdr.version, SAMPLE_FRAME_VERSION);
+	zassert_equal(hdr.flags, SAMPLE_FRAME_FLAG_EPOCH);
+	zassert_equal(hdr.mask, 0x0bU);
+	zassert_equal(hdr.seq, 0xfffeU);
+	zassert_equal(hdr.ticks, 0x123456789abcdeULL);
+	zassert_equal(hdr.period, SAMPLE_FRAME_PERIOD_MAX);
+	check_values(count, hdr.mask, ramp);
+}
+
+ZTEST(sample_frame, test_plain_clamps)
+{
+	struct sample_frame_enc enc;
+	struct sample_frame_hdr hdr;
+	const int16_t values[SAMPLE_FRAME_MAX_CHANNELS] = { -5, 5000 };
+
+	zassert_ok(sample_frame_begin(&enc, buf, sizeof(buf), 0x03U, 0U, 0U,
+				      0U, 1U));
+	zassert_ok(sample_frame_add(&enc, 0U, values));
+
+	zassert_equal(sample_frame_decode(buf, sample_frame_len(&enc), &hdr,
+					  out, MAX_VALUES), 1);
+	zassert_equal(out[0], 0U);
+	zassert_equal(out[1], SAMPLE_FRAME_VALUE_MAX);
+}
+
+ZTEST(sample_frame, test_delta_round_trip)
+{
+	struct sample_frame_hdr hdr;
+	size_t len;
+	int count;
+
+	encode(0x0bU, SAMPLE_FRAME_FLAG_DELTA, ramp, &count, &len);
+
+	/* A slow ramp codes in far fewer bits than plain samples */
+	zassert_true(count > PLAIN_SAMPLES, "only %d samples", count);
+
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, MAX_VALUES),
+		      count);
+	zassert_equal(hdr.flags, SAMPLE_FRAME_FLAG_DELTA);
+	zassert_equal(hdr.seq, 0xfffeU);
+	check_values(count, hdr.mask, ramp);
+}
+
+ZTEST(sample_frame, test_delta_escape)
+{
+	struct sample_frame_hdr hdr;
+	size_t len;
+	int count;
+
+	encode(0x03U, SAMPLE_FRAME_FLAG_DELTA, square, &count, &len);
+
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, MAX_VALUES),
+		      count);
+	check_values(count, hdr.mask, square);
+}
+
+ZTEST(sample_frame, test_add_refused)
+{
+	struct sample_frame_enc enc;
+	const int16_t values[SAMPLE_FRAME_MAX_CHANNELS] = { 0 };
+	uint8_t copy[BUF_LEN];
+	size_t len;
+
+	zassert_ok(sample_frame_begin(&enc, buf, SAMPLE_FRAME_HDR_LEN + 3U,
+				      0x01U, 0U, 7U, 0U, 1U));
+
+	zassert_equal(sample_frame_add(&enc, 8U, values), -ERANGE);
+	zassert_ok(sample_frame_add(&enc, 7U, values));
+	zassert_ok(sample_frame_add(&enc, 8U, values));
+	zassert_true(sample_frame_full(&enc));
+
+	/* A refused sample leaves the frame as it was */
+	len = sample_frame_len(&enc);
+	memcpy(copy, buf, len);
+	zassert_equal(sample_frame_add(&enc, 9U, values), -ENOSPC);
+	zassert_equal(sample_frame_len(&enc), len);
+	zassert_mem_equal(buf, copy, len);
+}
+
+ZTEST(sample_frame, test_begin_range)
+{
+	struct sample_frame_enc enc;
+
+	zassert_equal(sample_frame_begin(&enc, buf, sizeof(buf), 0x01U, 0U,
+					 0U, SAMPLE_FRAME_TICKS_MAX + 1U, 1U),
+		      -ERANGE);
+	zassert_equal(sample_frame_begin(&enc, buf, sizeof(buf), 0x01U, 0U,
+					 0U, 0U, SAMPLE_FRAME_PERIOD_MAX + 1U),
+		      -ERANGE);
+	zassert_equal(sample_frame_begin(&enc, buf, sizeof(buf), 0U, 0U, 0U,
+					 0U, 1U),
+		      -EINVAL);
+	zassert_equal(sample_frame_begin(&enc, buf, SAMPLE_FRAME_HDR_LEN,
+					 0x01U, SAMPLE_FRAME_FLAG_DELTA, 0U,
+					 0U, 1U),
+		      -EINVAL);
+}
+
+ZTEST(sample_frame, test_truncated)
+{
+	struct sample_frame_hdr hdr;
+	size_t len;
+	int count;
+
+	zassert_equal(sample_frame_parse(buf, SAMPLE_FRAME_HDR_LEN - 1U, &hdr),
+		      -EMSGSIZE);
+
+	encode(0x0bU, SAMPLE_FRAME_FLAG_DELTA, ramp, &count, &len);
+
+	/* The count byte is missing */
+	zassert_equal(sample_frame_parse(buf, SAMPLE_FRAME_HDR_LEN, &hdr),
+		      -EMSGSIZE);
+
+	/* Padding is less than a byte, so every cut loses coded bits */
+	for (size_t cut = SAMPLE_FRAME_HDR_LEN + 1U; cut < len; cut++) {
+		zassert_equal(sample_frame_decode(buf, cut, &hdr, out,
+						  MAX_VALUES),
+			      -EBADMSG, "cut at %zu", cut);
+	}
+}
+
+ZTEST(sample_frame, test_corrupt)
+{
+	struct sample_frame_enc enc;
+	struct sample_frame_hdr hdr;
+	const int16_t values[SAMPLE_FRAME_MAX_CHANNELS] = { 0 };
+	size_t len;
+	int count;
+
+	encode(0x0bU, 0U, ramp, &count, &len);
+
+	/* Room for fewer samples than the frame holds */
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, 3U),
+		      -ENOBUFS);
+
+	buf[1] = 0U;
+	zassert_equal(sample_frame_parse(buf, len, &hdr), -EINVAL);
+
+	buf[0] = (uint8_t)((SAMPLE_FRAME_VERSION - 1U) << 4);
+	zassert_equal(sample_frame_parse(buf, len, &hdr), -ENOTSUP);
+
+	/* One channel at 0, then a zero delta coded as a zero bit and
+	 * k = 1 low bit. Setting that bit turns the delta into -1, below
+	 * the smallest value.
+	 */
+	zassert_ok(sample_frame_begin(&enc, buf, sizeof(buf), 0x01U,
+				      SAMPLE_FRAME_FLAG_DELTA, 0U, 0U, 1U));
+	zassert_ok(sample_frame_add(&enc, 0U, values));
+	zassert_ok(sample_frame_add(&enc, 1U, values));
+	len = sample_frame_len(&enc);
+
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, MAX_VALUES), 2);
+
+	buf[16] |= BIT(5);
+	zassert_equal(sample_frame_decode(buf, len, &hdr, out, MAX_VALUES),
+		      -EBADMSG);
+}
+
+ZTEST_SUITE(sample_frame, NULL, NULL, NULL, NULL, NULL);
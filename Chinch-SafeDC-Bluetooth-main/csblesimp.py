@@ -1,10 +1,12 @@
 # https://www.linuxfixes.com/2022/02/solved-cannot-connect-to-arduino-over.html
+import argparse
 import asyncio
 
 from aioconsole import ainput
 from bleak import BleakClient, discover
 import os
-from datetime import datetime
+import struct
+from datetime import datetime, timedelta
 
 # Define path and name of output file
 #root_path = os.environ["HOME"]
@@ -18,41 +20,292 @@ path1 = r"C:\\Users\\Celia\\OneDrive - Johns Hopkins\\00. Chinchilla Current Sou
 path2 = str_date_time
 output_file = path1 + path2 + "Data.csv"
 
+# Binary sample frame sent by the Zephyr firmware, see
+# ADC_BLE_TEST_FINAL/src/sample_frame.h for the layout
+FRAME_VERSION = 3
+FRAME_HDR_LEN = 14
+FRAME_VALUE_BITS = 12
+FRAME_MAX_CHANNELS = 8
+# Timestamp counts from 1970-01-01 in the local time written to CTS
+FRAME_FLAG_EPOCH = 0x01
+# Samples are delta and Rice coded, see sample_frame.h
+FRAME_FLAG_DELTA = 0x02
+# Logged to flash while no client listened, replayed after reconnecting
+FRAME_FLAG_BACKFILL = 0x04
+RICE_ESCAPE = 8
+RICE_RESET = 32
+RICE_SUM_INIT = 2
+RICE_K_MAX = FRAME_VALUE_BITS - 1
 
+# Defaults of --tick-hz and --full-scale-mv: CONFIG_SYS_CLOCK_TICKS_PER_SEC
+# of nRF52 builds (RTC) and zephyr,vref-mv of the board overlay
+DEFAULT_TICK_HZ = 32768
+DEFAULT_FULL_SCALE_MV = 5000
 
-async def data_client(device):
+# Clock reconstruction: keep the least delayed frame of every window
+CLOCK_WINDOW_S = 10.0
+CLOCK_MAX_WINDOWS = 60
+
+# Control protocol on the write-without-response characteristic, see
+# ADC_BLE_TEST_FINAL/src/control.h
+CONTROL_RESPONSE = 0x80
+CONTROL_OPCODES = {
+    "start": 0x01,
+    "stop": 0x02,
+    "rate": 0x03,
+    "channels": 0x04,
+    "wiper": 0x05,
+    "stats": 0x06,
+    "current": 0x07,
+    "setpoint": 0x08,
+}
+CONTROL_STATUS = ["ok", "unknown opcode", "invalid length",
+                  "invalid parameter", "unsupported", "failed"]
+
+# Must match zephyr,resolution in the board overlay
+ADC_RESOLUTION = 12
+
+
+class BitReader:
+    """Reads LSB-first bit fields, matching put_bits() in the firmware."""
+
+    def __init__(self, data, offset):
+        self.bits = int.from_bytes(data[offset:], "little")
+        self.left = (len(data) - offset) * 8
+
+    def read(self, n):
+        if n > self.left:
+            raise ValueError("truncated frame")
+        val = self.bits & ((1 << n) - 1)
+        self.bits >>= n
+        self.left -= n
+        return val
+
+
+def decode_plain(data, nch):
+    reader = BitReader(data, FRAME_HDR_LEN)
+    count = (len(data) - FRAME_HDR_LEN) * 8 // (FRAME_VALUE_BITS * nch)
+    return [[reader.read(FRAME_VALUE_BITS) for _ in range(nch)]
+            for _ in range(count)]
+
+
+def decode_delta(data, nch):
+    count = data[FRAME_HDR_LEN]
+    reader = BitReader(data, FRAME_HDR_LEN + 1)
+    if count == 0:
+        return []
+    first = [reader.read(FRAME_VALUE_BITS) for _ in range(nch)]
+    samples = [first]
+    # Per channel [previous value, n, sum] as in sample_frame.c
+    state = [[v, 1, RICE_SUM_INIT] for v in first]
+    for _ in range(count - 1):
+        row = []
+        for st in state:
+            k = 0
+            while k < RICE_K_MAX and (st[1] << k) < st[2]:
+                k += 1
+            q = 0
+            while q < RICE_ESCAPE and reader.read(1):
+                q += 1
+            if q == RICE_ESCAPE:
+                val = reader.read(FRAME_VALUE_BITS)
+                d = val - st[0]
+                zz = (d << 1) ^ (d >> 31)
+            else:
+                zz = (q << k) | reader.read(k)
+                val = st[0] + ((zz >> 1) ^ -(zz & 1))
+            st[0] = val
+            st[2] += zz & 0xFFFFFFFF
+            st[1] += 1
+            if st[1] == RICE_RESET:
+                st[1] >>= 1
+                st[2] >>= 1
+            row.append(val)
+        samples.append(row)
+    return samples
+
+
+def decode_frame(data):
+    """Returns (flags, seq, ticks, period, channels, samples), samples in raw ADC codes."""
+    if len(data) < FRAME_HDR_LEN:
+        raise ValueError("frame shorter than its header")
+    version = data[0] >> 4
+    flags = data[0] & 0x0F
+    if version != FRAME_VERSION:
+        raise ValueError(f"unsupported frame version {version}")
+    mask = data[1]
+    seq, = struct.unpack_from("<H", data, 2)
+    ticks = int.from_bytes(data[4:11], "little")
+    period = int.from_bytes(data[11:14], "little")
+    channels = [ch for ch in range(FRAME_MAX_CHANNELS) if mask & (1 << ch)]
+    if not channels:
+        raise ValueError("empty channel mask")
+
+    if flags & FRAME_FLAG_DELTA:
+        samples = decode_delta(data, len(channels))
+    else:
+        samples = decode_plain(data, len(channels))
+    return flags, seq, ticks, period, channels, samples
+
+
+def raw_to_mv(raw, full_scale_mv):
+    return (raw * full_scale_mv) >> ADC_RESOLUTION
+
+
+def encode_command(line, token):
+    """Turns e.g. "rate 100" or "channels 0x3 1 4 1 1" into a request."""
+    words = line.split()
+    if not words or words[0] not in CONTROL_OPCODES:
+        raise ValueError("commands: " + ", ".join(CONTROL_OPCODES))
+    opcode = CONTROL_OPCODES[words[0]]
+    args = [int(w, 0) for w in words[1:]]
+    if words[0] in ("rate", "current", "setpoint"):
+        params = struct.pack("<H", *args)
+    else:
+        params = bytes(args)
+    return bytes([opcode, token & 0xFF]) + params
+
+
+def decode_response(data):
+    opcode, token, status = data[0] & ~CONTROL_RESPONSE, data[1], data[2]
+    name = next((k for k, v in CONTROL_OPCODES.items() if v == opcode), hex(opcode))
+    text = CONTROL_STATUS[status] if status < len(CONTROL_STATUS) else hex(status)
+    result = f"{name} #{token}: {text}"
+    if opcode == CONTROL_OPCODES["stats"] and status == 0:
+        scans, overflows, sent, dropped = struct.unpack_from("<IIII", data, 3)
+        result += (f" ({scans} scans, {overflows} ring overflows, "
+                   f"{sent} frames sent, {dropped} samples dropped)")
+    if opcode == CONTROL_OPCODES["current"] and status == 0:
+        result += f" (wiper {data[3]})"
+    return result
+
+
+def current_time_value(now):
+    """Encodes now as a CTS Current Time value (Exact Time 256 + adjust reason)."""
+    return struct.pack("<HBBBBBBBB", now.year, now.month, now.day, now.hour,
+                       now.minute, now.second, now.isoweekday(),
+                       now.microsecond * 256 // 1000000, 0)
+
+
+class DeviceClock:
+    """Maps device ticks to host wall clock time with drift correction.
+
+    A frame arrives some unknown BLE and scheduler delay after its first
+    sample was taken, so (arrival - device time) is the clock offset plus
+    a delay that is never negative. Per window only the smallest of these
+    is kept, and a line fitted through them gives the offset and the drift
+    of the device crystal against the host clock. Port of
+    ADC_BLE_TEST_FINAL/src/device_clock.cpp.
+    """
+
+    def __init__(self, tick_hz):
+        self.tick_hz = tick_hz
+        self.points = []  # [device seconds, smallest offset] per window
+
+    def observe(self, ticks, arrival):
+        device_s = ticks / self.tick_hz
+        offset = arrival - device_s
+        if self.points and device_s - self.points[-1][0] < CLOCK_WINDOW_S:
+            if offset < self.points[-1][1]:
+                self.points[-1] = [device_s, offset]
+        else:
+            self.points.append([device_s, offset])
+            del self.points[:-CLOCK_MAX_WINDOWS]
+
+    def to_wall(self, ticks):
+        device_s = ticks / self.tick_hz
+        if len(self.points) < 2:
+            return device_s + self.points[0][1]
+        # Least squares fit of offset = a + b * device_s
+        n = len(self.points)
+        mean_x = sum(p[0] for p in self.points) / n
+        mean_y = sum(p[1] for p in self.points) / n
+        sxx = sum((p[0] - mean_x) ** 2 for p in self.points)
+        sxy = sum((p[0] - mean_x) * (p[1] - mean_y) for p in self.points)
+        b = sxy / sxx if sxx else 0.0
+        return device_s + mean_y + b * (device_s - mean_x)
+
+
+
+async def data_client(device, options):
 
     #column_names = ["time", "delay", "Ch0", "Ch1", "Ch2", "Ch3"]
     
+    clock = DeviceClock(options.tick_hz)
+    # Replayed uptime frames that arrived before the clock was calibrated
+    backlog = []
+
+    def write_frame(f, flags, seq, ticks, period, channels, samples):
+        synced = flags & FRAME_FLAG_EPOCH
+        for i, row in enumerate(samples):
+            sample_ticks = ticks + i * period
+            if synced:
+                # Already wall clock time, set through CTS on connect
+                date_time = datetime(1970, 1, 1) + timedelta(seconds=sample_ticks / options.tick_hz)
+            else:
+                date_time = datetime.fromtimestamp(clock.to_wall(sample_ticks))
+            str_date_time = date_time.strftime("%d-%m-%Y, %H:%M:%S.%f")[:-3]
+            values = [""] * 4
+            for ch, raw in zip(channels, row):
+                if ch < len(values):
+                    values[ch] = str(raw_to_mv(raw, options.full_scale_mv))
+            f.write(f"{str_date_time},{','.join(values)},{(seq + i) & 0xFFFF},{sample_ticks},\n")
+
     def handle_rx(_: int, data: bytearray):
-        print("received:", data)
-        column_names = ["Date","Time","Ch0", "Ch1", "Ch2", "Ch3"]
+        print("received:", data.hex())
+        column_names = ["Date","Time","Ch0", "Ch1", "Ch2", "Ch3", "Seq", "Ticks"]
         f=open(output_file, "a+")
         if os.stat(output_file).st_size == 0:
             print("Created file.")
             f.write(",".join([str(name) for name in column_names]) + ",\n")
+        try:
+            frame = decode_frame(data)
+        except (ValueError, IndexError, struct.error) as err:
+            print("Dropped frame:", err)
+            f.close()
+            return
+        flags, ticks = frame[0], frame[2]
+        # Sample times come from the device clock, arrival only calibrates
+        # it. Replayed frames arrive late and say nothing about the offset.
+        if not flags & (FRAME_FLAG_EPOCH | FRAME_FLAG_BACKFILL):
+            clock.observe(ticks, datetime.now().timestamp())
+        if not flags & FRAME_FLAG_EPOCH and not clock.points:
+            backlog.append(frame)
         else:
-            #print(data,"\n")
-            datastr = bytearray.decode(data)
-            current_time = datetime.now()
-            time_stamp = current_time.timestamp()
-            date_time = datetime.fromtimestamp(time_stamp)
-            str_date_time = date_time.strftime("%d-%m-%Y, %H:%M:%S")
-            f.write(f"{str_date_time},{datastr[0:4].strip()},{datastr[5:9]},{datastr[10:14].strip()},{datastr[15:19].strip()},\n")
+            if clock.points:
+                for old in backlog:
+                    write_frame(f, *old)
+                backlog.clear()
+            write_frame(f, *frame)
+        f.close()
         
     async with BleakClient(device,timeout=30) as client:
         #print('\nCheckpoint 2 COMPLETE')
+        # Set the device clock once, frames are then stamped with wall time
+        try:
+            await client.write_gatt_char(current_time_characteristic,
+                                         current_time_value(datetime.now()), response=True)
+        except Exception as err:
+            print("Could not set device time:", err)
         await client.start_notify(read_characteristic, handle_rx)
+        await client.start_notify(control_characteristic,
+                                  lambda _, data: print(decode_response(data)))
         #print('\nCheckpoint 3 COMPLETE')
+        token = 0
         while client.is_connected:
             await asyncio.sleep(1)
             input_str = await ainput("Enter command: ")
-            bytes_to_send = input_str.encode()
             if input_str == 'e':
                 await client.stop_notify(read_characteristic)
                 await client.disconnect()
-            else:
-                await client.write_gatt_char(write_characteristic, bytes_to_send)
+                continue
+            try:
+                request = encode_command(input_str, token)
+            except (ValueError, struct.error) as err:
+                print("Invalid command:", err)
+                continue
+            token += 1
+            await client.write_gatt_char(control_characteristic, request, response=False)
 
 
 async def select_device():
@@ -79,7 +332,7 @@ async def select_device():
     print("Please make valid selection.")
 
 
-async def main():
+async def main(options):
     # device = "A3E0539E-3CF8-867E-2B7B-1EE451EC384B" ## UUID for nRF52DK on-board chip
     #device = "F182A17D-0E1C-61E7-27B9-B75D127C16BD" #F7271A17-39B3-88FB-F069-52806225AA94" ## UUID's for 2 different EV on-board chip
     #device = "0279880A-5E98-E7A3-23AE-E1BC4CCA98C2" ## UUID for BLE V2 PCB chip!
@@ -95,7 +348,7 @@ async def main():
                 keep_alive = False
         elif device:
             #print('\nCheckpoint 1 COMPLETE')
-            await data_client(device)
+            await data_client(device, options)
             device = None
             print('Device disconnected.\n')
 
@@ -103,6 +356,8 @@ async def main():
 # For nRF52DK on-board chip:
 write_characteristic = "6E400003-B5A3-F393-E0A9-E50E24DCCA9E" #ARDUINO
 read_characteristic = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E" #ARDUINO
+control_characteristic = "12345678-1234-5678-1234-56789abcdef4" # Write without response + notify
+current_time_characteristic = "00002a2b-0000-1000-8000-00805f9b34fb" # CTS Current Time
 #write_characteristic = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E" # SEGGER
 #read_characteristic = "6E400003-B5A3-F393-E0A9-E50E24DCCA9E" # SEGGER
 
@@ -111,4 +366,9 @@ read_characteristic = "6E400002-B5A3-F393-E0A9-E50E24DCCA9E" #ARDUINO
 #read_characteristic = ""
 
 if __name__ == "__main__":
-    asyncio.run(main())
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--tick-hz", type=int, default=DEFAULT_TICK_HZ,
+                        help="CONFIG_SYS_CLOCK_TICKS_PER_SEC of the firmware build")
+    parser.add_argument("--full-scale-mv", type=int, default=DEFAULT_FULL_SCALE_MV,
+                        help="zephyr,vref-mv of the board overlay")
+    asyncio.run(main(parser.parse_args()))
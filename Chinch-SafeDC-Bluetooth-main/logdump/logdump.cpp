@@ -0,0 +1,692 @@
+/** @file
+ *  @brief Bulk download of the sample log
+ *
+ *  Host side of the Log Transfer service (see log_xfer.h in the
+ *  firmware). Pulls the device's sample log in MTU sized chunks and
+ *  appends them to a file as they arrive:
+ *
+ *    logdump [--release] <address> <file>
+ *    logdump --decode [--tick-hz <hz>] <file>
+ *
+ *  The file holds the log byte stream, each frame as a u16 length and
+ *  the frame. Chunks are checked against their offset and CRC-32; a bad
+ *  or missing one restarts the read from the last good offset. That
+ *  offset, the device's boot ID and the file size it matches are kept
+ *  in <file>.offset, so an interrupted download resumes where it
+ *  stopped, unless the device rebooted meanwhile. With --release the
+ *  downloaded frames are released on the device afterwards.
+ *
+ *  A download that catches up with a log still growing ends on a frame
+ *  taken moments before it arrived. Its timestamp and arrival time go
+ *  to <file>.clock, along with where the device's boot starts in the
+ *  file; over several downloads they give the offset and drift of the
+ *  device clock.
+ *
+ *  --decode prints the frames of a downloaded file as CSV. Frames
+ *  stamped with the time a client wrote through CTS, and uptime frames
+ *  of the boot <file>.clock covers, also get a local time. --tick-hz is
+ *  CONFIG_SYS_CLOCK_TICKS_PER_SEC of the firmware build.
+ */
+
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <simpleble/SimpleBLE.h>
+
+#include "sample_frame.h"
+#include "log_xfer.h"
+#include "device_clock.h"
+
+namespace {
+
+const std::string xfer_svc = "6e400040-b5a3-f393-e0a9-e50e24dcca9e";
+const std::string xfer_info = "6e400041-b5a3-f393-e0a9-e50e24dcca9e";
+const std::string xfer_cp = "6e400042-b5a3-f393-e0a9-e50e24dcca9e";
+const std::string xfer_data = "6e400043-b5a3-f393-e0a9-e50e24dcca9e";
+
+const auto scan_time = std::chrono::seconds(5);
+const auto rsp_timeout = std::chrono::seconds(5);
+/* Without a chunk for this long the read is restarted */
+const auto chunk_timeout = std::chrono::seconds(3);
+/* The resume offset is saved every this many bytes */
+const uint32_t save_interval = 16384;
+/* Kernel tick rate of nRF52 builds, where the RTC drives the clock */
+const double default_tick_hz = 32768.0;
+
+uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void put_le32(uint32_t v, uint8_t *p)
+{
+	for (int i = 0; i < 4; i++) {
+		p[i] = v >> (8 * i);
+	}
+}
+
+/* CRC-32 as in IEEE 802.3, matches crc32_ieee() on the device */
+uint32_t crc32_ieee(const uint8_t *data, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+
+	for (size_t i = 0; i < len; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+
+	return ~crc;
+}
+
+/* Notifications arrive on a SimpleBLE thread and are handed over here */
+class Inbox {
+public:
+	void push(std::string value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		items.push_back(std::move(value));
+		cond.notify_one();
+	}
+
+	std::optional<std::string> pop(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (!cond.wait_for(lock, timeout,
+				   [this] { return !items.empty(); })) {
+			return std::nullopt;
+		}
+
+		std::string value = std::move(items.front());
+		items.pop_front();
+		return value;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<std::string> items;
+};
+
+class Download {
+public:
+	explicit Download(SimpleBLE::Peripheral &peripheral)
+		: peripheral(peripheral)
+	{
+		peripheral.notify(xfer_svc, xfer_cp,
+				  [this](SimpleBLE::ByteArray value) {
+					  responses.push(std::string(value));
+				  });
+		peripheral.notify(xfer_svc, xfer_data,
+				  [this](SimpleBLE::ByteArray value) {
+					  chunks.push(std::string(value));
+				  });
+	}
+
+	~Download()
+	{
+		peripheral.unsubscribe(xfer_svc, xfer_data);
+		peripheral.unsubscribe(xfer_svc, xfer_cp);
+	}
+
+	/* Returns the device's first and end offset, and keeps its boot
+	 * ID for the saved progress
+	 */
+	std::pair<uint32_t, uint32_t> range()
+	{
+		std::string info = peripheral.read(xfer_svc, xfer_info);
+		const auto *p = reinterpret_cast<const uint8_t *>(info.data());
+
+		if (info.size() < 16) {
+			throw std::runtime_error("Short object info");
+		}
+
+		boot = get_le32(&p[12]);
+
+		std::cout << "Log: offsets " << get_le32(&p[0]) << " to "
+			  << get_le32(&p[4]) << ", " << get_le32(&p[8])
+			  << " frames, boot " << boot << std::endl;
+
+		return { get_le32(&p[0]), get_le32(&p[4]) };
+	}
+
+	/* 0 if the device does not count its boots */
+	uint32_t boot_id() const
+	{
+		return boot;
+	}
+
+	/* Host time in seconds the last data arrived */
+	double last_arrival() const
+	{
+		return arrival;
+	}
+
+	/* Sends a command and returns the status and results of its
+	 * response
+	 */
+	std::string command(uint8_t op, const std::vector<uint8_t> &param)
+	{
+		std::string req(1, static_cast<char>(op));
+
+		req.append(param.begin(), param.end());
+		peripheral.write_request(xfer_svc, xfer_cp, req);
+
+		auto deadline = std::chrono::steady_clock::now() + rsp_timeout;
+
+		while (std::chrono::steady_clock::now() < deadline) {
+			auto rsp = responses.pop(rsp_timeout);
+
+			if (rsp && rsp->size() >= 2 &&
+			    static_cast<uint8_t>((*rsp)[0]) ==
+				    (op | LOG_XFER_RESPONSE)) {
+				return rsp->substr(1);
+			}
+		}
+
+		throw std::runtime_error("No response to command");
+	}
+
+	/* Appends the log from off to out, returns the offset reached */
+	uint32_t run(uint32_t off, std::ofstream &out,
+		     const std::string &progress_path)
+	{
+		uint32_t saved = off;
+		auto start = std::chrono::steady_clock::now();
+		uint64_t bytes = 0;
+
+		read(off);
+
+		while (true) {
+			auto chunk = chunks.pop(chunk_timeout);
+
+			if (!chunk) {
+				std::cout << "Stalled at " << off
+					  << ", reading again" << std::endl;
+				read(off);
+				continue;
+			}
+
+			const auto *p = reinterpret_cast<const uint8_t *>(
+				chunk->data());
+
+			if (chunk->size() < LOG_XFER_CHUNK_HDR_LEN ||
+			    get_le32(&p[0]) != off) {
+				/* Left over from a read that was restarted */
+				continue;
+			}
+
+			size_t len = chunk->size() - LOG_XFER_CHUNK_HDR_LEN;
+
+			if (crc32_ieee(&p[LOG_XFER_CHUNK_HDR_LEN], len) !=
+			    get_le32(&p[4])) {
+				std::cout << "CRC error at " << off
+					  << ", reading again" << std::endl;
+				read(off);
+				continue;
+			}
+
+			if (len == 0) {
+				break;
+			}
+
+			out.write(reinterpret_cast<const char *>(
+					  &p[LOG_XFER_CHUNK_HDR_LEN]),
+				  len);
+			arrival = std::chrono::duration<double>(
+					  std::chrono::system_clock::now()
+						  .time_since_epoch())
+					  .count();
+			off += len;
+			bytes += len;
+
+			if (off - saved >= save_interval) {
+				save_progress(out, progress_path, off);
+				saved = off;
+			}
+		}
+
+		save_progress(out, progress_path, off);
+
+		double secs = std::chrono::duration<double>(
+				      std::chrono::steady_clock::now() - start)
+				      .count();
+		std::cout << "Downloaded " << bytes << " bytes in " << secs
+			  << " s (" << (secs > 0 ? bytes / secs : 0) << " B/s)"
+			  << std::endl;
+
+		return off;
+	}
+
+	void save_progress(std::ofstream &out, const std::string &path,
+			   uint32_t off)
+	{
+		/* Data first, so the offset never runs ahead of the file */
+		out.flush();
+		std::ofstream(path, std::ios::trunc) << boot << " " << off << " "
+						     << out.tellp() << std::endl;
+	}
+
+private:
+	void read(uint32_t off)
+	{
+		std::vector<uint8_t> param(8, 0);
+		std::string rsp;
+
+		put_le32(off, &param[0]);
+		rsp = command(LOG_XFER_OP_READ, param);
+
+		if (static_cast<uint8_t>(rsp[0]) != LOG_XFER_STATUS_OK) {
+			throw std::runtime_error(
+				"Read refused, status " +
+				std::to_string(static_cast<uint8_t>(rsp[0])));
+		}
+	}
+
+	SimpleBLE::Peripheral &peripheral;
+	Inbox responses;
+	Inbox chunks;
+	uint32_t boot = 0;
+	double arrival = 0.0;
+};
+
+/* Length of the complete frames in the first limit bytes of the file */
+uint64_t complete_len(const std::string &path, uint64_t limit)
+{
+	std::ifstream in(path, std::ios::binary);
+	uint64_t len = 0;
+	uint8_t hdr[2];
+
+	while (in.read(reinterpret_cast<char *>(hdr), sizeof(hdr))) {
+		uint64_t next = len + 2 + (hdr[0] | hdr[1] << 8);
+
+		if (next > limit) {
+			break;
+		}
+
+		len = next;
+		in.seekg(len);
+	}
+
+	return len;
+}
+
+/* Header of the last complete frame in the file */
+std::optional<sample_frame_hdr> last_frame(const std::string &path)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> frame;
+	std::optional<sample_frame_hdr> last;
+	uint8_t hdr[2];
+
+	while (in.read(reinterpret_cast<char *>(hdr), sizeof(hdr))) {
+		sample_frame_hdr fh;
+
+		frame.resize(hdr[0] | hdr[1] << 8);
+		if (!in.read(reinterpret_cast<char *>(frame.data()),
+			     frame.size())) {
+			break;
+		}
+
+		if (sample_frame_parse(frame.data(), frame.size(), &fh) == 0) {
+			last = fh;
+		}
+	}
+
+	return last;
+}
+
+/* Clock observations of one boot, and the file size its frames start at */
+struct ClockLog {
+	uint32_t boot = 0;
+	uint64_t start = 0;
+	std::vector<std::pair<uint64_t, double>> points;
+};
+
+std::optional<ClockLog> load_clock(const std::string &path)
+{
+	std::ifstream in(path);
+	ClockLog clock;
+	uint64_t ticks;
+	double arrival;
+
+	if (!(in >> clock.boot >> clock.start)) {
+		return std::nullopt;
+	}
+
+	while (in >> ticks >> arrival) {
+		clock.points.emplace_back(ticks, arrival);
+	}
+
+	return clock;
+}
+
+/* Records the last frame of a download that reached the end of a log
+ * still being written. start is where the download began; a clock log
+ * of another boot is replaced by one starting there, so frames of the
+ * boot fetched by earlier downloads stay unmapped.
+ */
+void save_clock(const std::string &path, uint32_t boot, uint64_t start,
+		double arrival)
+{
+	const std::string clock_path = path + ".clock";
+	auto clock = load_clock(clock_path);
+	auto fh = last_frame(path);
+
+	/* Frames stamped with the client's time need no reconstruction */
+	if (!fh || (fh->flags & SAMPLE_FRAME_FLAG_EPOCH)) {
+		return;
+	}
+
+	if (!clock || clock->boot != boot) {
+		clock = ClockLog{ boot, start, {} };
+	}
+
+	clock->points.emplace_back(fh->ticks, arrival);
+
+	std::ofstream out(clock_path, std::ios::trunc);
+
+	out << clock->boot << " " << clock->start << "\n"
+	    << std::setprecision(17);
+	for (const auto &[ticks, when] : clock->points) {
+		out << ticks << " " << when << "\n";
+	}
+}
+
+/* Stream offset reached, the boot it counts from and the file size it
+ * corresponds to
+ */
+struct Progress {
+	uint32_t boot;
+	uint32_t off;
+	uint64_t size;
+};
+
+std::optional<Progress> load_progress(const std::string &path)
+{
+	std::ifstream in(path);
+	Progress progress;
+
+	if (in >> progress.boot >> progress.off >> progress.size) {
+		return progress;
+	}
+
+	return std::nullopt;
+}
+
+/* Prints seconds since 1970 as a date and time, as local time or as
+ * the time zone the seconds already count in
+ */
+void print_time(double secs, bool local)
+{
+	auto whole = static_cast<std::time_t>(secs);
+	int ms = static_cast<int>((secs - whole) * 1000.0);
+	std::tm *tm = local ? std::localtime(&whole) : std::gmtime(&whole);
+
+	if (tm) {
+		std::cout << std::put_time(tm, "%Y-%m-%d %H:%M:%S") << "."
+			  << std::setw(3) << std::setfill('0') << ms
+			  << std::setfill(' ');
+	}
+}
+
+int decode(const std::string &path, double tick_hz)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<uint8_t> frame;
+	std::vector<uint16_t> values(SAMPLE_FRAME_MAX_SAMPLES *
+				     SAMPLE_FRAME_MAX_CHANNELS);
+	auto clock_log = load_clock(path + ".clock");
+	DeviceClock clock(tick_hz);
+	uint64_t pos = 0;
+	uint8_t hdr[2];
+
+	if (!in) {
+		std::cerr << "Cannot open " << path << std::endl;
+		return 1;
+	}
+
+	if (clock_log) {
+		for (const auto &[ticks, arrival] : clock_log->points) {
+			clock.observe(ticks, arrival);
+		}
+	}
+
+	std::cout << "Seq,Ticks,Epoch,Time,Ch0,Ch1,Ch2,Ch3" << std::endl;
+
+	while (in.read(reinterpret_cast<char *>(hdr), sizeof(hdr))) {
+		struct sample_frame_hdr fh;
+		uint64_t at = pos;
+		int count;
+
+		frame.resize(hdr[0] | hdr[1] << 8);
+		if (!in.read(reinterpret_cast<char *>(frame.data()),
+			     frame.size())) {
+			break;
+		}
+		pos += sizeof(hdr) + frame.size();
+
+		count = sample_frame_decode(frame.data(), frame.size(), &fh,
+					    values.data(), values.size());
+		if (count <= 0) {
+			std::cerr << "Dropped frame (err " << count << ")"
+				  << std::endl;
+			continue;
+		}
+
+		size_t channels = 0;
+		for (unsigned int ch = 0; ch < SAMPLE_FRAME_MAX_CHANNELS; ch++) {
+			channels += (fh.mask >> ch) & 1U;
+		}
+
+		bool epoch = fh.flags & SAMPLE_FRAME_FLAG_EPOCH;
+		/* Uptime of earlier boots counts from another origin */
+		bool mapped = !epoch && clock_log && at >= clock_log->start;
+
+		for (int i = 0; i < count; i++) {
+			const uint16_t *row = &values[i * channels];
+			uint64_t ticks = fh.ticks + (uint64_t)i * fh.period;
+			size_t n = 0;
+
+			std::cout << ((fh.seq + i) & 0xffff) << "," << ticks
+				  << "," << (epoch ? 1 : 0) << ",";
+			if (epoch) {
+				print_time(ticks / tick_hz, false);
+			} else if (auto wall = clock.to_wall(ticks);
+				   mapped && wall) {
+				print_time(*wall, true);
+			}
+			for (unsigned int ch = 0; ch < 4; ch++) {
+				std::cout << ",";
+				if (fh.mask & (1U << ch)) {
+					std::cout << row[n++];
+				}
+			}
+			std::cout << "\n";
+		}
+	}
+
+	return 0;
+}
+
+std::optional<SimpleBLE::Peripheral> find(const std::string &address)
+{
+	auto adapters = SimpleBLE::Adapter::get_adapters();
+
+	if (adapters.empty()) {
+		std::cerr << "No Bluetooth adapter" << std::endl;
+		return std::nullopt;
+	}
+
+	auto &adapter = adapters[0];
+
+	adapter.scan_for(std::chrono::duration_cast<std::chrono::milliseconds>(
+				 scan_time)
+				 .count());
+
+	for (auto &peripheral : adapter.scan_get_results()) {
+		std::string found = peripheral.address();
+
+		if (std::equal(found.begin(), found.end(), address.begin(),
+			       address.end(), [](char a, char b) {
+				       return std::tolower(a) ==
+					      std::tolower(b);
+			       })) {
+			return peripheral;
+		}
+	}
+
+	std::cerr << address << " not found" << std::endl;
+	return std::nullopt;
+}
+
+int download(const std::string &address, const std::string &path,
+	     bool release)
+{
+	const std::string progress_path = path + ".offset";
+	auto peripheral = find(address);
+
+	if (!peripheral) {
+		return 1;
+	}
+
+	peripheral->connect();
+	std::cout << "Connected, MTU " << peripheral->mtu() << std::endl;
+
+	Download dl(*peripheral);
+	auto [first, end] = dl.range();
+	auto progress = load_progress(progress_path);
+	uint64_t size = 0;
+	uint32_t off = first;
+	std::error_code ec;
+
+	if (std::filesystem::exists(path)) {
+		size = std::filesystem::file_size(path);
+	}
+
+	/* Offsets count from the device's boot. One of an earlier boot, or
+	 * outside the log because it was overwritten meanwhile, does not
+	 * apply; the new data then follows the last complete frame of the
+	 * file.
+	 */
+	bool same_boot = progress && dl.boot_id() != 0 &&
+			 progress->boot == dl.boot_id();
+
+	if (same_boot && (int32_t)(progress->off - first) >= 0 &&
+	    (int32_t)(end - progress->off) >= 0 && progress->size <= size) {
+		off = progress->off;
+		size = progress->size;
+		std::cout << "Resuming at " << off << std::endl;
+	} else {
+		if (progress) {
+			std::cout << "Offset " << progress->off
+				  << (same_boot ? " no longer in the log"
+						: " is from another boot")
+				  << ", appending from " << first << std::endl;
+			size = std::min(size, progress->size);
+		}
+		size = complete_len(path, size);
+	}
+
+	/* Drops what was written after the last saved offset */
+	std::ofstream(path, std::ios::binary | std::ios::app).close();
+	std::filesystem::resize_file(path, size, ec);
+	if (ec) {
+		std::cerr << "Cannot resize " << path << ": " << ec.message()
+			  << std::endl;
+		return 1;
+	}
+
+	std::ofstream out(path, std::ios::binary | std::ios::app);
+
+	off = dl.run(off, out, progress_path);
+	out.close();
+
+	/* The log grew while it was read, so its last frame is fresh */
+	if (dl.boot_id() != 0 && (int32_t)(off - end) > 0) {
+		save_clock(path, dl.boot_id(), size, dl.last_arrival());
+	}
+
+	if (release) {
+		std::vector<uint8_t> param(4);
+		std::string rsp;
+
+		put_le32(off, &param[0]);
+		rsp = dl.command(LOG_XFER_OP_RELEASE, param);
+
+		if (rsp.size() >= 5 &&
+		    static_cast<uint8_t>(rsp[0]) == LOG_XFER_STATUS_OK) {
+			std::cout << "Released "
+				  << get_le32(reinterpret_cast<const uint8_t *>(
+					     &rsp[1]))
+				  << " frames" << std::endl;
+		} else {
+			std::cerr << "Release failed" << std::endl;
+		}
+	}
+
+	peripheral->disconnect();
+
+	return 0;
+}
+
+} /* namespace */
+
+int main(int argc, char **argv)
+{
+	std::vector<std::string> args(argv + 1, argv + argc);
+	bool release = false;
+
+	if (!args.empty() && args[0] == "--decode") {
+		double tick_hz = default_tick_hz;
+
+		if (args.size() == 4 && args[1] == "--tick-hz") {
+			tick_hz = std::strtod(args[2].c_str(), nullptr);
+			args.erase(args.begin() + 1, args.begin() + 3);
+		}
+
+		if (args.size() == 2 && tick_hz > 0.0) {
+			return decode(args[1], tick_hz);
+		}
+	}
+
+	if (!args.empty() && args[0] == "--release") {
+		release = true;
+		args.erase(args.begin());
+	}
+
+	if (args.size() != 2 || args[0] == "--decode") {
+		std::cerr << "usage: logdump [--release] <address> <file>\n"
+			  << "       logdump --decode [--tick-hz <hz>] <file>"
+			  << std::endl;
+		return 2;
+	}
+
+	try {
+		return download(args[0], args[1], release);
+	} catch (const std::exception &err) {
+		std::cerr << err.what() << std::endl;
+		return 1;
+	}
+}